@@ -0,0 +1,46 @@
+#include "BufferTransfer.hpp"
+
+using namespace std;
+
+static bool sharesHostMemory(const boost::compute::device& device) {
+    if (device.type() & CL_DEVICE_TYPE_CPU) return true;
+    return device.get_info<cl_bool>(CL_DEVICE_HOST_UNIFIED_MEMORY) == CL_TRUE;
+}
+
+BufferTransfer::BufferTransfer(const boost::compute::device& device, boost::compute::command_queue& queue)
+    : zeroCopy(sharesHostMemory(device)), queue(queue)
+{
+}
+
+BufferTransfer::~BufferTransfer()
+{
+    UnmapAll();
+}
+
+boost::compute::buffer BufferTransfer::Create(const boost::compute::context& context, size_t size, cl_mem_flags flags) const
+{
+    // Lets the runtime place the buffer where the host can map it without a copy
+    if (zeroCopy) flags |= CL_MEM_ALLOC_HOST_PTR;
+    return boost::compute::buffer(context, size, flags);
+}
+
+void BufferTransfer::Unmap(const boost::compute::buffer& buffer)
+{
+    for (auto it = mappings.begin(); it != mappings.end(); ) {
+        if (it->buffer.get() == buffer.get()) {
+            queue.enqueue_unmap_buffer(it->buffer, it->ptr);
+            it = mappings.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void BufferTransfer::UnmapAll()
+{
+    for (const Mapping& mapping : mappings) {
+        queue.enqueue_unmap_buffer(mapping.buffer, mapping.ptr);
+    }
+    mappings.clear();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <vector>
+
+#include <boost/compute/buffer.hpp>
+#include <boost/compute/context.hpp>
+#include <boost/compute/command_queue.hpp>
+#include <boost/compute/device.hpp>
+
+// Allocates buffers that the host reads or writes and moves data through them.
+// Devices sharing memory with the host (CPU runtimes, integrated GPUs) get CL_MEM_ALLOC_HOST_PTR buffers that are
+// mapped in place, discrete devices get plain buffers and explicit copies through a host staging array.
+class BufferTransfer
+{
+public:
+    BufferTransfer(const boost::compute::device& device, boost::compute::command_queue& queue);
+    ~BufferTransfer();
+
+    bool IsZeroCopy() const { return zeroCopy; }
+
+    boost::compute::buffer Create(const boost::compute::context& context, size_t size, cl_mem_flags flags) const;
+
+    // Calls fill(T* dst) to write count elements to the start of the buffer
+    template<class T, class Fill>
+    void Write(const boost::compute::buffer& buffer, size_t count, std::vector<T>& staging, Fill fill);
+
+    // Returns count elements from the start of the buffer, valid until it is unmapped.
+    // Kernels must not use a buffer while it is mapped.
+    template<class T>
+    const T* Read(const boost::compute::buffer& buffer, size_t count, std::vector<T>& staging);
+
+    void Unmap(const boost::compute::buffer& buffer);
+    void UnmapAll();
+
+private:
+    struct Mapping {
+        // Keeps the buffer alive even if its owner replaces it while mapped
+        boost::compute::buffer buffer;
+        void* ptr;
+    };
+
+    const bool zeroCopy;
+    boost::compute::command_queue& queue;
+    std::vector<Mapping> mappings;
+};
+
+template<class T, class Fill>
+void BufferTransfer::Write(const boost::compute::buffer& buffer, size_t count, std::vector<T>& staging, Fill fill)
+{
+    if (count == 0) return;
+
+    if (zeroCopy) {
+        Unmap(buffer);
+        T* dst = (T*)queue.enqueue_map_buffer(buffer, CL_MAP_WRITE_INVALIDATE_REGION, 0, count * sizeof(T));
+        fill(dst);
+        // Later commands on the in-order queue see the data once the unmap runs
+        queue.enqueue_unmap_buffer(buffer, dst);
+        return;
+    }
+
+    if (staging.size() < count) staging.resize(count);
+    fill(staging.data());
+    queue.enqueue_write_buffer(buffer, 0, count * sizeof(T), staging.data());
+}
+
+template<class T>
+const T* BufferTransfer::Read(const boost::compute::buffer& buffer, size_t count, std::vector<T>& staging)
+{
+    if (zeroCopy) {
+        Unmap(buffer);
+        void* ptr = queue.enqueue_map_buffer(buffer, CL_MAP_READ, 0, count * sizeof(T));
+        mappings.push_back({ buffer, ptr });
+        return (const T*)ptr;
+    }
+
+    if (staging.size() < count) staging.resize(count);
+    queue.enqueue_read_buffer(buffer, 0, count * sizeof(T), staging.data());
+    return staging.data();
+}
@@ -0,0 +1,16 @@
+#include "CLSceneTypes.hpp"
+
+cl_Material::cl_Material() : ambient({ 0., 0., 0. }), diffuse(ambient), specular(ambient), absorption(1), reflection(0), transparency(0), shininess(1) { }
+cl_Material::cl_Material(const Material& cpy) : absorption(cpy.absorption), reflection(cpy.reflection), transparency(cpy.transparency), shininess(cpy.shininess) {
+    cpyVec3ToFloat3(&ambient, cpy.ambient);
+    cpyVec3ToFloat3(&diffuse, cpy.diffuse);
+    cpyVec3ToFloat3(&specular, cpy.specular);
+}
+
+cl_ObjectData::cl_ObjectData() : mv({ 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 }), mvInverse(mv), mvInverseTranspose(mv), type(0) { }
+cl_ObjectData::cl_ObjectData(const ObjectData& cpy) : mat(cpy.mat) {
+    cpyMat4ToFloat16(&mv, cpy.mv);
+    cpyMat4ToFloat16(&mvInverse, cpy.mvInverse);
+    cpyMat4ToFloat16(&mvInverseTranspose, cpy.mvInverseTranspose);
+    type = (cl_uint)cpy.type;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Material.hpp"
+#include "ObjectData.hpp"
+
+// Device layouts of the scene objects, shared by every kernel that reads them.
+// Must match Material and ObjectData in shade_and_reflect_kernel.cl and hittest_kernel.cl
+
+struct cl_Material {
+    cl_float3 ambient, diffuse, specular;
+    cl_float absorption, reflection, transparency;
+    cl_float shininess;
+
+    cl_Material();
+    cl_Material(const Material& cpy);
+};
+
+struct cl_ObjectData {
+    cl_Material mat;
+    cl_float16 mv, mvInverse, mvInverseTranspose;
+    cl_uint type;
+    // Necessary for alignment on vram (for my drivers)
+    uint8_t spacer[60];
+
+    cl_ObjectData();
+    cl_ObjectData(const ObjectData& cpy);
+};
+
+inline void cpyVec3ToFloat3(cl_float3* dest, const glm::vec3& src) {
+    *dest = { src.x, src.y, src.z };
+}
+inline void cpyVec4ToFloat4(cl_float4* dest, const glm::vec4& src) {
+    *dest = { src.x, src.y, src.z, src.w };
+}
+inline void cpyMat4ToFloat16(cl_float16* dest, const glm::mat4& src) {
+    const float* m = glm::value_ptr(src);
+    *dest = { m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8], m[9], m[10], m[11], m[12], m[13], m[14], m[15] };
+}
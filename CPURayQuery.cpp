@@ -0,0 +1,58 @@
+#include "CPURayQuery.hpp"
+
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+
+// Batches smaller than this per thread aren't worth starting a thread for
+static const size_t MinRaysPerThread = 4096;
+
+CPURayQuery::CPURayQuery(const std::vector<ObjectData>& objects) : IRayQuery(objects)
+{
+}
+
+void CPURayQuery::Query(const Ray3D* rays, size_t count, RayQueryMode mode, RayHit* o_hits, float maxTime)
+{
+    // Objects are read in place, there is nothing to reload
+    loadedVersion = version;
+
+    size_t threadCount = max<size_t>(thread::hardware_concurrency(), 1);
+    threadCount = min(threadCount, max<size_t>(count / MinRaysPerThread, 1));
+
+    size_t raysPerThread = (count + threadCount - 1) / threadCount;
+    vector<thread> workers;
+    for (size_t first = raysPerThread; first < count; first += raysPerThread) {
+        workers.emplace_back(&CPURayQuery::QueryRange, this, rays, first, min(first + raysPerThread, count), mode, o_hits, maxTime);
+    }
+    // The calling thread takes the first range
+    QueryRange(rays, 0, min(raysPerThread, count), mode, o_hits, maxTime);
+
+    for (thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void CPURayQuery::QueryRange(const Ray3D* rays, size_t first, size_t last, RayQueryMode mode, RayHit* o_hits, float maxTime) const
+{
+    for (size_t ii = first; ii < last; ++ii) {
+        HitRecord hit;
+        // Raycast only takes hits closer than the current time
+        hit.time = maxTime;
+
+        RayHit& result = o_hits[ii];
+        result = RayHit();
+        for (size_t objIndex = 0; objIndex < objects.size(); ++objIndex) {
+            float lastTime = hit.time;
+            objects[objIndex].Raycast(rays[ii], hit);
+            if (hit.time == lastTime) continue;
+
+            result.object = (cl_int)objIndex;
+            if (mode == RayQueryMode::anyHit) break;
+        }
+
+        if (result.object < 0) continue;
+        result.time = hit.time;
+        result.normal = hit.normal;
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "IRayQuery.hpp"
+
+// Ray queries on the host through ObjectData::Raycast, split across the hardware threads
+class CPURayQuery : public IRayQuery
+{
+public:
+    CPURayQuery(const std::vector<ObjectData>& objects);
+
+    // Inherited via IRayQuery
+    using IRayQuery::Query;
+    virtual void Query(const Ray3D* rays, size_t count, RayQueryMode mode, RayHit* o_hits, float maxTime = MAX_FLOAT) override;
+
+private:
+    void QueryRange(const Ray3D* rays, size_t first, size_t last, RayQueryMode mode, RayHit* o_hits, float maxTime) const;
+};
@@ -0,0 +1,59 @@
+#include "Camera.hpp"
+
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+
+Camera::Camera(size_t width, size_t height, float fov) : width(width), height(height), fov(fov) { }
+
+void Camera::GenerateRays(std::vector<Ray3D>& o_rays) const
+{
+    GenerateRays(o_rays, cropX, cropY, width, height);
+}
+
+void Camera::Crop(size_t fullWidth, size_t fullHeight, size_t x, size_t y, size_t windowWidth, size_t windowHeight)
+{
+    imageWidth = fullWidth;
+    imageHeight = fullHeight;
+    cropX = x;
+    cropY = y;
+    width = windowWidth;
+    height = windowHeight;
+}
+
+void Camera::GenerateRays(std::vector<Ray3D>& o_rays, size_t x, size_t y, size_t regionWidth, size_t regionHeight) const
+{
+    float halfWidth = ImageWidth() / 2.0f;
+    float halfHeight = ImageHeight() / 2.0f;
+    float focalLength = FocalLength();
+
+    glm::mat4 cameraToScene = CameraToScene();
+    glm::vec3 start = glm::vec3(cameraToScene * glm::vec4(0.f, 0.f, 0.f, 1.f));
+
+    o_rays.clear();
+    o_rays.reserve(regionWidth * regionHeight);
+
+    for (size_t jj = y; jj < y + regionHeight; ++jj) {
+        for (size_t ii = x; ii < x + regionWidth; ++ii) {
+            glm::vec4 direction(ii - halfWidth, ((float)ImageHeight() - jj) - halfHeight, -focalLength, 0.f);
+            o_rays.emplace_back(start, glm::vec3(cameraToScene * direction));
+        }
+    }
+}
+
+glm::mat4 Camera::CameraToScene() const
+{
+    glm::mat4 transform = glm::translate(glm::mat4(1.f), position);
+    transform = glm::rotate(transform, yaw, glm::vec3(0.f, 1.f, 0.f));
+    transform = glm::rotate(transform, pitch, glm::vec3(1.f, 0.f, 0.f));
+    return transform;
+}
+
+glm::mat4 Camera::SceneToCamera() const
+{
+    return glm::inverse(CameraToScene());
+}
+
+float Camera::FocalLength() const
+{
+    return (ImageHeight() / 2.0f) / tanf(fov);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Ray3D.hpp"
+
+// Pinhole camera in scene (view) space. The default pose matches the fixed camera baked into SceneLoader.
+class Camera
+{
+public:
+    Camera() { }
+    Camera(size_t width, size_t height, float fov);
+
+    // One ray per pixel of the rendered window, rows from the top of the image down
+    void GenerateRays(std::vector<Ray3D>& o_rays) const;
+    // Rays for a region of the full image, the region may extend past its edges
+    void GenerateRays(std::vector<Ray3D>& o_rays, size_t x, size_t y, size_t regionWidth, size_t regionHeight) const;
+
+    // Renders a width by height window at (x, y) of a larger image, e.g. one render farm tile
+    void Crop(size_t fullWidth, size_t fullHeight, size_t x, size_t y, size_t windowWidth, size_t windowHeight);
+    size_t ImageWidth() const { return imageWidth ? imageWidth : width; }
+    size_t ImageHeight() const { return imageHeight ? imageHeight : height; }
+
+    glm::mat4 CameraToScene() const;
+    glm::mat4 SceneToCamera() const;
+
+    // Distance from the eye to the image plane, in pixels
+    float FocalLength() const;
+
+    glm::vec3 position{ 0.f, 0.f, 0.f };
+    // Radians, yaw turns around +Y and pitch around the camera's X axis
+    float yaw = 0.f, pitch = 0.f;
+
+    // Resolution rendered, the whole image unless cropped
+    size_t width = 1, height = 1;
+    // Full image a cropped camera is a window of, 0 when not cropped
+    size_t imageWidth = 0, imageHeight = 0;
+    size_t cropX = 0, cropY = 0;
+    // Half of the vertical field of view, in radians
+    float fov = 0.5f;
+};
+
+struct TemporalSettings {
+    // Reuse the previous frame's colors for pixels that reproject onto the same surface
+    bool enabled = false;
+    // Relative difference in hit distance still treated as the same surface
+    cl_float depthTolerance = 0.02f;
+    // Every reused pixel is re-traced at least once per this many frames
+    cl_uint refreshInterval = 16;
+};
@@ -0,0 +1,99 @@
+#include "CostHeatmap.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+using namespace std;
+
+// Blue, cyan, green, yellow, red
+static const float rampColors[5][3] = { { 0.f, 0.f, 1.f }, { 0.f, 1.f, 1.f }, { 0.f, 1.f, 0.f }, { 1.f, 1.f, 0.f }, { 1.f, 0.f, 0.f } };
+
+static void rampColor(float t, uint8_t rgb[3]) {
+    float position = min(max(t, 0.f), 1.f) * 4.f;
+    int stop = min((int)position, 3);
+    float blend = position - stop;
+    for (int channel = 0; channel < 3; ++channel) {
+        float value = rampColors[stop][channel] + (rampColors[stop + 1][channel] - rampColors[stop][channel]) * blend;
+        rgb[channel] = (uint8_t)(value * 255.f + 0.5f);
+    }
+}
+
+void CostHeatmap::Build(const std::vector<PixelCost>& costs, size_t width, size_t height, std::vector<uint8_t>& o_pixels, Frame& o_frame)
+{
+    size_t count = min(costs.size(), width * height);
+
+    cl_uint maxTests = 0;
+    for (size_t ii = 0; ii < count; ++ii) {
+        maxTests = max(maxTests, costs[ii].intersectionTests);
+    }
+
+    // Costs span orders of magnitude between background and mirror pixels, a linear scale would hide everything but the worst
+    float scale = (maxTests > 0) ? 1.f / log1p((float)maxTests) : 0.f;
+
+    o_pixels.assign(width * height * BytesPerPixel(PixelFormat::rgba8), 0);
+    for (size_t ii = 0; ii < count; ++ii) {
+        uint8_t* pixel = &o_pixels[ii * 4];
+        rampColor(log1p((float)costs[ii].intersectionTests) * scale, pixel);
+        pixel[3] = 255;
+    }
+
+    o_frame.pixels = o_pixels.data();
+    o_frame.width = width;
+    o_frame.height = height;
+    o_frame.format = PixelFormat::rgba8;
+}
+
+void CostHeatmap::Report(std::ostream& out, const std::vector<PixelCost>& costs)
+{
+    if (costs.empty()) return;
+
+    uint64_t totalTests = 0, totalShadowRays = 0, totalBounces = 0;
+    cl_uint maxTests = 0, maxShadowRays = 0, maxBounces = 0;
+    // Bucket b holds pixels with [2^(b-1), 2^b) tests, bucket 0 the ones with none
+    vector<size_t> histogram(33, 0);
+    for (const PixelCost& cost : costs) {
+        totalTests += cost.intersectionTests;
+        totalShadowRays += cost.shadowRays;
+        totalBounces += cost.bounces;
+        maxTests = max(maxTests, cost.intersectionTests);
+        maxShadowRays = max(maxShadowRays, cost.shadowRays);
+        maxBounces = max(maxBounces, cost.bounces);
+
+        size_t bucket = 0;
+        for (cl_uint tests = cost.intersectionTests; tests > 0; tests >>= 1) ++bucket;
+        ++histogram[bucket];
+    }
+
+    double pixels = (double)costs.size();
+    out << fixed << setprecision(1);
+    out << "Per-pixel cost over " << costs.size() << " pixels (mean / max):\n";
+    out << "  intersection tests " << totalTests / pixels << " / " << maxTests << "\n";
+    out << "  shadow rays        " << totalShadowRays / pixels << " / " << maxShadowRays << "\n";
+    out << "  bounces            " << totalBounces / pixels << " / " << maxBounces << "\n";
+
+    out << "Intersection tests per pixel:\n";
+    size_t largestBucket = *max_element(histogram.begin(), histogram.end());
+    size_t lastBucket = 0;
+    for (size_t bucket = 0; bucket < histogram.size(); ++bucket) {
+        if (histogram[bucket] > 0) lastBucket = bucket;
+    }
+    for (size_t bucket = 0; bucket <= lastBucket; ++bucket) {
+        uint64_t low = (bucket == 0) ? 0 : (uint64_t)1 << (bucket - 1);
+        uint64_t high = (bucket == 0) ? 0 : ((uint64_t)1 << bucket) - 1;
+        size_t barLength = (histogram[bucket] * 50 + largestBucket - 1) / largestBucket;
+
+        out << "  " << setw(10) << low << " - " << setw(10) << high << " " << setw(5) << 100.0 * histogram[bucket] / pixels << "% " << string(barLength, '#') << "\n";
+    }
+    out << defaultfloat;
+}
+
+std::string CostHeatmap::HeatmapPath(const std::string& outFileLoc)
+{
+    size_t extension = outFileLoc.find_last_of('.');
+    size_t directory = outFileLoc.find_last_of("/\\");
+    if (extension == std::string::npos || (directory != std::string::npos && extension < directory))
+        return outFileLoc + "_cost";
+
+    return outFileLoc.substr(0, extension) + "_cost" + outFileLoc.substr(extension);
+}
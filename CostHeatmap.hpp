@@ -0,0 +1,27 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Frame.hpp"
+
+// Work one pixel's trace took. Must match the uint4 written to costData in shade_and_reflect_kernel.cl
+struct PixelCost {
+    cl_uint intersectionTests = 0, shadowRays = 0, bounces = 0;
+    cl_uint spacer = 0;
+};
+
+// Turns per-pixel trace costs into a false-color image and a text summary
+class CostHeatmap
+{
+public:
+    // rgba8 frame of the intersection tests per pixel on a log scale, blue for the cheapest and red for the most expensive
+    static void Build(const std::vector<PixelCost>& costs, size_t width, size_t height, std::vector<uint8_t>& o_pixels, Frame& o_frame);
+
+    // Totals per counter and a log2 histogram of the intersection tests
+    static void Report(std::ostream& out, const std::vector<PixelCost>& costs);
+
+    // render.ppm becomes render_cost.ppm
+    static std::string HeatmapPath(const std::string& outFileLoc);
+};
@@ -0,0 +1,108 @@
+#include "Denoiser.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// B3 spline, matches the weights in denoise_kernel.cl
+const static float KernelWeights[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+static inline float distanceSquared(const cl_float4& lhs, const cl_float4& rhs) {
+    float dx = lhs.s[0] - rhs.s[0];
+    float dy = lhs.s[1] - rhs.s[1];
+    float dz = lhs.s[2] - rhs.s[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+static void filterRows(size_t rowBegin, size_t rowEnd, size_t width, size_t height, int stepWidth, float colorPhi, const DenoiseSettings& settings,
+    const cl_float4* colorIn, const cl_float* depthData, const cl_float4* normalData, const cl_float4* albedoData, cl_float4* colorOut) {
+    for (size_t y = rowBegin; y < rowEnd; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            size_t ii = y * width + x;
+
+            const cl_float4& centerColor = colorIn[ii];
+            float centerDepth = depthData[ii];
+
+            // Background pixels have no surface to filter against
+            if (centerDepth <= 0.f) {
+                colorOut[ii] = centerColor;
+                continue;
+            }
+
+            float sum[3] = { 0.f, 0.f, 0.f };
+            float weightSum = 0.f;
+
+            for (int dy = -2; dy <= 2; ++dy) {
+                long sy = (long)y + dy * stepWidth;
+                if (sy < 0 || sy >= (long)height) continue;
+
+                for (int dx = -2; dx <= 2; ++dx) {
+                    long sx = (long)x + dx * stepWidth;
+                    if (sx < 0 || sx >= (long)width) continue;
+
+                    size_t jj = (size_t)sy * width + (size_t)sx;
+
+                    float sampleDepth = depthData[jj];
+                    if (sampleDepth <= 0.f) continue;
+
+                    float colorWeight = expf(-distanceSquared(centerColor, colorIn[jj]) / colorPhi);
+                    float normalWeight = expf(-distanceSquared(normalData[ii], normalData[jj]) / settings.normalPhi);
+                    float depthWeight = expf(-fabsf(centerDepth - sampleDepth) / (settings.depthPhi * centerDepth));
+                    float albedoWeight = expf(-distanceSquared(albedoData[ii], albedoData[jj]) / settings.albedoPhi);
+
+                    float weight = KernelWeights[dx + 2] * KernelWeights[dy + 2] * colorWeight * normalWeight * depthWeight * albedoWeight;
+
+                    for (int channel = 0; channel < 3; ++channel) {
+                        sum[channel] += weight * colorIn[jj].s[channel];
+                    }
+                    weightSum += weight;
+                }
+            }
+
+            // The center sample always contributes, so weightSum is never 0
+            colorOut[ii] = { sum[0] / weightSum, sum[1] / weightSum, sum[2] / weightSum, centerColor.s[3] };
+        }
+    }
+}
+
+void CPUDenoiser::Denoise(size_t width, size_t height, const DenoiseSettings& settings, cl_float4* colorData, const cl_float* depthData, const cl_float4* normalData, const cl_float4* albedoData)
+{
+    if (settings.iterations == 0) return;
+
+    const size_t pixelCount = width * height;
+    vector<cl_float4> scratch(pixelCount);
+
+    cl_float4* src = colorData;
+    cl_float4* dst = scratch.data();
+
+    const size_t threadCount = max(1u, thread::hardware_concurrency());
+    const size_t rowsPerThread = (height + threadCount - 1) / threadCount;
+
+    float colorPhi = settings.colorPhi;
+
+    for (cl_uint pass = 0; pass < settings.iterations; ++pass) {
+        int stepWidth = 1 << pass;
+
+        vector<thread> workers;
+        workers.reserve(threadCount);
+        for (size_t rowBegin = 0; rowBegin < height; rowBegin += rowsPerThread) {
+            size_t rowEnd = min(height, rowBegin + rowsPerThread);
+            workers.emplace_back(filterRows, rowBegin, rowEnd, width, height, stepWidth, colorPhi, cref(settings), src, depthData, normalData, albedoData, dst);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        swap(src, dst);
+        // Coarser passes average over a wider footprint, so tolerate less color variation
+        colorPhi *= 0.5f;
+    }
+
+    if (src != colorData) {
+        copy(src, src + pixelCount, colorData);
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <CL/cl.h>
+
+enum class DenoiseMode {
+    none,
+    // Filter passes run as kernels on the device that traced the frame
+    device,
+    // G-buffers are read back and filtered on the host
+    host
+};
+
+struct DenoiseSettings {
+    DenoiseMode mode = DenoiseMode::none;
+    // Each pass doubles the filter footprint (1, 2, 4, ...)
+    cl_uint iterations = 5;
+    // Edge-stopping falloffs, smaller values preserve more edges
+    cl_float colorPhi = 0.5f, normalPhi = 0.1f, depthPhi = 0.05f, albedoPhi = 0.1f;
+};
+
+class CPUDenoiser
+{
+public:
+    // Edge-aware a-trous wavelet filter guided by depth, normal and albedo. Depth <= 0 marks background pixels.
+    static void Denoise(size_t width, size_t height, const DenoiseSettings& settings, cl_float4* colorData, const cl_float* depthData, const cl_float4* normalData, const cl_float4* albedoData);
+};
@@ -0,0 +1,148 @@
+#include "Frame.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+size_t BytesPerPixel(PixelFormat format)
+{
+    switch (format) {
+    case PixelFormat::rgba32f:
+        return sizeof(cl_float4);
+    case PixelFormat::rgba16f:
+        return 4 * sizeof(cl_half);
+    case PixelFormat::rgb10a2:
+    case PixelFormat::rgba8:
+        return sizeof(cl_uint);
+    }
+    return 0;
+}
+
+inline float toneMapChannel(const OutputSettings& settings, float value) {
+    value *= settings.exposure;
+    if (settings.toneMapping == ToneMapping::reinhard)
+        value = value / (1.f + value);
+    value = min(max(value, 0.f), 1.f);
+    return powf(value, 1.f / settings.gamma);
+}
+
+inline cl_half floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    // Tone-mapped values are in [0, 1], so only underflow needs handling
+    if (exponent <= 0) return (cl_half)sign;
+    if (exponent >= 31) return (cl_half)(sign | 0x7c00);
+
+    // Round to nearest
+    mantissa += 0x1000;
+    if (mantissa & 0x800000) {
+        mantissa = 0;
+        ++exponent;
+    }
+
+    return (cl_half)(sign | ((uint32_t)exponent << 10) | (mantissa >> 13));
+}
+
+inline float halfToFloat(cl_half value) {
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0) {
+        // Denormals are flushed, they are all below 8-bit precision
+        bits = sign;
+    }
+    else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float out;
+    memcpy(&out, &bits, sizeof(out));
+    return out;
+}
+
+inline uint32_t quantize(float value, uint32_t maxValue) {
+    return (uint32_t)lroundf(min(max(value, 0.f), 1.f) * (float)maxValue);
+}
+
+void PackPixels(const OutputSettings& settings, const cl_float4* src, size_t count, void* dst)
+{
+    for (size_t ii = 0; ii < count; ++ii) {
+        float r = toneMapChannel(settings, src[ii].s[0]);
+        float g = toneMapChannel(settings, src[ii].s[1]);
+        float b = toneMapChannel(settings, src[ii].s[2]);
+        float a = src[ii].s[3];
+
+        switch (settings.format) {
+        case PixelFormat::rgba32f:
+            ((cl_float4*)dst)[ii] = { r, g, b, a };
+            break;
+        case PixelFormat::rgba16f:
+        {
+            cl_half* out = (cl_half*)dst + ii * 4;
+            out[0] = floatToHalf(r);
+            out[1] = floatToHalf(g);
+            out[2] = floatToHalf(b);
+            out[3] = floatToHalf(a);
+            break;
+        }
+        case PixelFormat::rgb10a2:
+            ((cl_uint*)dst)[ii] = quantize(r, 1023) | (quantize(g, 1023) << 10) | (quantize(b, 1023) << 20) | (quantize(a, 3) << 30);
+            break;
+        case PixelFormat::rgba8:
+        {
+            cl_uchar* out = (cl_uchar*)dst + ii * 4;
+            out[0] = (cl_uchar)quantize(r, 255);
+            out[1] = (cl_uchar)quantize(g, 255);
+            out[2] = (cl_uchar)quantize(b, 255);
+            out[3] = (cl_uchar)quantize(a, 255);
+            break;
+        }
+        }
+    }
+}
+
+void UnpackRGB8(const Frame& frame, size_t index, uint8_t rgb[3])
+{
+    switch (frame.format) {
+    case PixelFormat::rgba32f:
+    {
+        const cl_float4& pixel = ((const cl_float4*)frame.pixels)[index];
+        for (int channel = 0; channel < 3; ++channel)
+            rgb[channel] = (uint8_t)quantize(pixel.s[channel], 255);
+        break;
+    }
+    case PixelFormat::rgba16f:
+    {
+        const cl_half* pixel = (const cl_half*)frame.pixels + index * 4;
+        for (int channel = 0; channel < 3; ++channel)
+            rgb[channel] = (uint8_t)quantize(halfToFloat(pixel[channel]), 255);
+        break;
+    }
+    case PixelFormat::rgb10a2:
+    {
+        cl_uint pixel = ((const cl_uint*)frame.pixels)[index];
+        for (int channel = 0; channel < 3; ++channel)
+            rgb[channel] = (uint8_t)(((pixel >> (10 * channel)) & 0x3ff) >> 2);
+        break;
+    }
+    case PixelFormat::rgba8:
+    {
+        const cl_uchar* pixel = (const cl_uchar*)frame.pixels + index * 4;
+        for (int channel = 0; channel < 3; ++channel)
+            rgb[channel] = pixel[channel];
+        break;
+    }
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <cstdint>
+#include <cstddef>
+
+enum class PixelFormat {
+    // Tone-mapped but unquantized, 16 bytes per pixel
+    rgba32f,
+    // 8 bytes per pixel
+    rgba16f,
+    // 4 bytes per pixel, matches GL_UNSIGNED_INT_2_10_10_10_REV
+    rgb10a2,
+    // 4 bytes per pixel
+    rgba8
+};
+
+enum class ToneMapping {
+    clamp,
+    reinhard
+};
+
+struct OutputSettings {
+    PixelFormat format = PixelFormat::rgba8;
+    ToneMapping toneMapping = ToneMapping::clamp;
+    cl_float exposure = 1.f;
+    cl_float gamma = 1.f;
+};
+
+// A rendered image in its output format. Pixels are owned by the raytracer and stay valid until its next Render().
+struct Frame {
+    const void* pixels = NULL;
+    size_t width = 0, height = 0;
+    PixelFormat format = PixelFormat::rgba8;
+};
+
+size_t BytesPerPixel(PixelFormat format);
+
+// Host-side equivalent of the pack kernels in output_kernel.cl
+void PackPixels(const OutputSettings& settings, const cl_float4* src, size_t count, void* dst);
+
+// Reads a single pixel of any format back as 8-bit RGB
+void UnpackRGB8(const Frame& frame, size_t index, uint8_t rgb[3]);
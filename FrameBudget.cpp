@@ -0,0 +1,48 @@
+#include "FrameBudget.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+FrameBudgetController::FrameBudgetController(const FrameBudgetSettings& settings, cl_uint maxBounces)
+    : settings(settings), maxBounces(maxBounces), bounceLimit(maxBounces) { }
+
+bool FrameBudgetController::Update(float frameTime)
+{
+    if (!IsEnabled()) return false;
+
+    smoothedFrameTime = (smoothedFrameTime < 0.f) ? frameTime : 0.7f * smoothedFrameTime + 0.3f * frameTime;
+
+    // Frame time is roughly proportional to the pixel count, so resolution moves by the square root
+    float ratio = settings.targetFrameTime / max(smoothedFrameTime, 0.001f);
+    cl_uint minBounces = min(settings.minBounces, maxBounces);
+
+    cl_uint newBounceLimit = bounceLimit;
+    float newScale = resolutionScale;
+
+    // Dead band around the target so quality doesn't flicker
+    if (ratio < 0.9f) {
+        if (bounceLimit > minBounces)
+            newBounceLimit = max(bounceLimit / 2, minBounces);
+        else
+            newScale = max(resolutionScale * max(sqrt(ratio), 0.5f), settings.minResolutionScale);
+    }
+    else if (ratio > 1.25f) {
+        if (resolutionScale < 1.f)
+            newScale = min(resolutionScale * min(sqrt(ratio), 1.2f), 1.f);
+        else if (bounceLimit < maxBounces)
+            newBounceLimit = min(max(bounceLimit * 2, 1u), maxBounces);
+    }
+
+    // Snap to 1/32 steps, away from the current scale, so small corrections don't reset history every frame
+    newScale = (newScale < resolutionScale) ? floor(newScale * 32.f) / 32.f : ceil(newScale * 32.f) / 32.f;
+    newScale = min(max(newScale, settings.minResolutionScale), 1.f);
+
+    if (newBounceLimit == bounceLimit && newScale == resolutionScale) return false;
+
+    bounceLimit = newBounceLimit;
+    resolutionScale = newScale;
+    smoothedFrameTime = -1.f;
+    return true;
+}
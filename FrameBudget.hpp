@@ -0,0 +1,46 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <cstdint>
+
+struct QualitySettings {
+    // Reflection bounces per ray, never more than the raytracer was created with
+    cl_uint bounceLimit = UINT32_MAX;
+    // Paths whose remaining throughput falls below this are ended at random, 0 disables
+    cl_float rouletteThreshold = 0.f;
+};
+
+struct FrameBudgetSettings {
+    // Milliseconds per frame to hold, 0 leaves quality alone
+    float targetFrameTime = 0.f;
+    float minResolutionScale = 0.25f;
+    cl_uint minBounces = 1;
+    // Russian roulette used for frames rendered below full quality, a larger --roulette takes precedence
+    cl_float rouletteThreshold = 0.05f;
+};
+
+// Trades bounces and internal resolution for frame time. Bounces go first when over budget,
+// resolution comes back first when there is time to spare.
+class FrameBudgetController
+{
+public:
+    FrameBudgetController(const FrameBudgetSettings& settings, cl_uint maxBounces);
+
+    bool IsEnabled() const { return settings.targetFrameTime > 0.f; }
+    bool IsFullQuality() const { return bounceLimit == maxBounces && resolutionScale == 1.f; }
+
+    // Feeds the time the last frame's trace took in milliseconds, returns whether the bounce limit or resolution scale changed
+    bool Update(float frameTime);
+
+    cl_uint BounceLimit() const { return bounceLimit; }
+    float ResolutionScale() const { return resolutionScale; }
+
+private:
+    const FrameBudgetSettings settings;
+    const cl_uint maxBounces;
+
+    cl_uint bounceLimit;
+    float resolutionScale = 1.f;
+    // Negative until a frame at the current quality has been measured
+    float smoothedFrameTime = -1.f;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <CL/cl.h>
+#include <cstdint>
+#include <vector>
+#include "HitRecord.hpp"
+#include "ObjectData.hpp"
+#include "Ray3D.hpp"
+
+enum class RayQueryMode {
+    // Nearest hit along each ray
+    closestHit,
+    // Any hit before maxTime, for visibility and occlusion tests. Stops at the first object found.
+    anyHit
+};
+
+// Result of one ray. Must match RayHit in hittest_kernel.cl.
+struct RayHit {
+    // Scene-space normal at the hit
+    glm::vec3 normal;
+    // Distance along the ray in units of its direction, MAX_FLOAT on a miss
+    float time = MAX_FLOAT;
+    // Index into the queried objects, -1 on a miss
+    cl_int object = -1;
+    cl_int spacer[3];
+};
+
+// Casts caller-supplied batches of scene-space rays against a set of objects. The objects stay loaded between
+// queries, so callers can run many batches against the same scene without paying for it again.
+class IRayQuery
+{
+public:
+    virtual ~IRayQuery() { }
+
+    // Fills o_hits[0, count) for rays[0, count). Only hits closer than maxTime count.
+    virtual void Query(const Ray3D* rays, size_t count, RayQueryMode mode, RayHit* o_hits, float maxTime = MAX_FLOAT) = 0;
+
+    void Query(const std::vector<Ray3D>& rays, RayQueryMode mode, std::vector<RayHit>& o_hits, float maxTime = MAX_FLOAT) {
+        o_hits.resize(rays.size());
+        if (!rays.empty())
+            Query(rays.data(), rays.size(), mode, o_hits.data(), maxTime);
+    }
+
+    // Call after modifying the objects passed to the constructor, their count must stay the same
+    void Invalidate() { ++version; }
+
+protected:
+    const std::vector<ObjectData>& objects;
+
+    // Bumped by Invalidate(), copied to loadedVersion once the objects are reloaded
+    uint64_t version = 1, loadedVersion = 0;
+
+    IRayQuery(const std::vector<ObjectData>& objects) : objects(objects) { }
+};
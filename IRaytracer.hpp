@@ -2,21 +2,80 @@
 
 #include <glm/glm.hpp>
 #include <CL/cl.h>
+#include <array>
+#include <cstdint>
 #include <vector>
 #include "HitRecord.hpp"
 #include "Light.hpp"
 #include "ObjectData.hpp"
+#include "Camera.hpp"
+#include "Denoiser.hpp"
+#include "Frame.hpp"
+#include "LightTree.hpp"
+#include "FrameBudget.hpp"
+
+// What a caller changed since the last Render()
+enum class SceneChange : size_t {
+    // Object transforms or primitive types
+    geometry,
+    // Material values of existing objects
+    materials,
+    lights,
+    // Ray origins or directions
+    camera,
+    denoise,
+    output,
+    // Bounce limit or russian roulette
+    quality,
+    count
+};
 
 class IRaytracer
 {
 public:
-    virtual cl_float4* Render() = 0;
+    // Returns the cached frame when nothing was invalidated since the last call
+    virtual const Frame& Render() = 0;
+    // Starts the current state rendering without waiting for it, the next Render() collects it.
+    // Changes made in between are left for the frame after.
+    virtual void Submit() { }
+
+    // Call after modifying the vectors passed to the constructor, counts must stay the same
+    void Invalidate(SceneChange change) { ++version[(size_t)change]; }
+    bool IsFrameCurrent() const { return renderedVersion == version; }
+
+    void SetDenoiseSettings(const DenoiseSettings& settings) { denoiseSettings = settings; Invalidate(SceneChange::denoise); }
+    void SetOutputSettings(const OutputSettings& settings) { outputSettings = settings; Invalidate(SceneChange::output); }
+    void SetTemporalSettings(const TemporalSettings& settings) { temporalSettings = settings; }
+    void SetLightSamplingSettings(const LightSamplingSettings& settings) { lightSamplingSettings = settings; Invalidate(SceneChange::lights); }
+    void SetQualitySettings(const QualitySettings& settings) { qualitySettings = settings; Invalidate(SceneChange::quality); }
+
+    // The camera the current rays were generated from, needed for temporal reprojection. Its width and height set the
+    // resolution rendered at, which may be lower than the one the raytracer was created with.
+    void SetCamera(const Camera& camera) { this->camera = camera; hasCamera = true; Invalidate(SceneChange::camera); }
 
 protected:
     const std::vector<ObjectData>& objects;
     const std::vector<Light>& lights;
     const std::vector<Ray3D>& rays;
+    const size_t width, height;
 
-    IRaytracer(const std::vector<ObjectData>& objects, const std::vector<Light>& lights, const std::vector<Ray3D>& rays) : objects(objects), lights(lights), rays(rays) { }
-};
+    DenoiseSettings denoiseSettings;
+    OutputSettings outputSettings;
+    TemporalSettings temporalSettings;
+    LightSamplingSettings lightSamplingSettings;
+    QualitySettings qualitySettings;
+
+    Camera camera;
+    bool hasCamera = false;
+
+    // Bumped by Invalidate(), copied to renderedVersion once a frame reflects them
+    std::array<uint64_t, (size_t)SceneChange::count> version, renderedVersion;
 
+    bool Changed(SceneChange change) const { return version[(size_t)change] != renderedVersion[(size_t)change]; }
+
+    IRaytracer(const std::vector<ObjectData>& objects, const std::vector<Light>& lights, const std::vector<Ray3D>& rays, size_t width, size_t height) : objects(objects), lights(lights), rays(rays), width(width), height(height) {
+        // Everything is out of date until the first frame
+        version.fill(1);
+        renderedVersion.fill(0);
+    }
+};
@@ -0,0 +1,60 @@
+#include "LightTree.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+void LightTree::Build(const std::vector<Light>& lights, std::vector<LightTreeNode>& o_nodes)
+{
+    o_nodes.clear();
+    if (lights.empty()) return;
+
+    o_nodes.reserve(lights.size() * 2 - 1);
+
+    vector<int> lightIndices(lights.size());
+    for (size_t ii = 0; ii < lights.size(); ++ii) {
+        lightIndices[ii] = (int)ii;
+    }
+
+    BuildNode(lights, lightIndices, 0, lightIndices.size(), o_nodes);
+}
+
+float LightTree::Power(const Light& light)
+{
+    // Luminance of what the light adds on top of ambient, kept above 0 so every light can still be picked
+    glm::vec3 color = light.diffuse + light.specular;
+    return max(0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z, 1e-4f);
+}
+
+int LightTree::BuildNode(const std::vector<Light>& lights, std::vector<int>& lightIndices, size_t begin, size_t end, std::vector<LightTreeNode>& o_nodes)
+{
+    int nodeIndex = (int)o_nodes.size();
+    o_nodes.emplace_back();
+
+    LightTreeNode node;
+    node.boundsMin = node.boundsMax = glm::vec3(lights[lightIndices[begin]].lightPosition);
+    for (size_t ii = begin; ii < end; ++ii) {
+        const Light& light = lights[lightIndices[ii]];
+        node.boundsMin = glm::min(node.boundsMin, glm::vec3(light.lightPosition));
+        node.boundsMax = glm::max(node.boundsMax, glm::vec3(light.lightPosition));
+        node.power += Power(light);
+    }
+
+    if (end - begin == 1) {
+        node.light = lightIndices[begin];
+        o_nodes[nodeIndex] = node;
+        return nodeIndex;
+    }
+
+    // Median split along the widest axis
+    glm::vec3 extent = node.boundsMax - node.boundsMin;
+    int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    size_t middle = begin + (end - begin) / 2;
+    nth_element(lightIndices.begin() + begin, lightIndices.begin() + middle, lightIndices.begin() + end,
+        [&](int lhs, int rhs) { return lights[lhs].lightPosition[axis] < lights[rhs].lightPosition[axis]; });
+
+    node.left = BuildNode(lights, lightIndices, begin, middle, o_nodes);
+    node.right = BuildNode(lights, lightIndices, middle, end, o_nodes);
+    o_nodes[nodeIndex] = node;
+    return nodeIndex;
+}
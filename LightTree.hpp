@@ -0,0 +1,36 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Light.hpp"
+
+struct LightSamplingSettings {
+    // Scenes with at most this many lights shadow test every one of them
+    cl_uint exactLightLimit = 8;
+    // Lights picked per shading point from larger scenes
+    cl_uint samples = 4;
+};
+
+struct LightTreeNode {
+    glm::vec3 boundsMin{ 0.f, 0.f, 0.f }, boundsMax{ 0.f, 0.f, 0.f };
+    // Summed over every light below
+    float power = 0.f;
+    // Children of inner nodes, -1 on leaves
+    int left = -1, right = -1;
+    // Light of a leaf, -1 on inner nodes
+    int light = -1;
+};
+
+// Binary hierarchy over light positions, used to pick lights in proportion to how much they could contribute
+class LightTree
+{
+public:
+    // The root is o_nodes[0], every light ends up in its own leaf
+    static void Build(const std::vector<Light>& lights, std::vector<LightTreeNode>& o_nodes);
+
+    static float Power(const Light& light);
+
+private:
+    static int BuildNode(const std::vector<Light>& lights, std::vector<int>& lightIndices, size_t begin, size_t end, std::vector<LightTreeNode>& o_nodes);
+};
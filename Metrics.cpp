@@ -0,0 +1,132 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+using namespace std;
+
+const size_t Metrics::Capacity;
+
+// Static storage is zero-initialized, so every ring starts empty
+Metrics::Ring Metrics::rings[(size_t)MetricStage::count];
+std::atomic<bool> Metrics::reportRequested(false);
+
+void Metrics::Record(MetricStage stage, uint64_t microseconds)
+{
+    Ring& ring = rings[(size_t)stage];
+    uint64_t index = ring.writeIndex.fetch_add(1, memory_order_relaxed);
+    ring.samples[index % Capacity].store((uint32_t)min<uint64_t>(microseconds, UINT32_MAX), memory_order_relaxed);
+}
+
+MetricSummary Metrics::Summarize(MetricStage stage)
+{
+    const Ring& ring = rings[(size_t)stage];
+    size_t count = (size_t)min<uint64_t>(ring.writeIndex.load(memory_order_relaxed), Capacity);
+
+    MetricSummary summary;
+    if (count == 0) return summary;
+
+    vector<uint32_t> samples(count);
+    for (size_t ii = 0; ii < count; ++ii) {
+        samples[ii] = ring.samples[ii].load(memory_order_relaxed);
+    }
+    sort(samples.begin(), samples.end());
+
+    // Nearest-rank percentiles
+    auto percentile = [&](double p) {
+        size_t rank = (size_t)ceil(p * count);
+        return samples[max<size_t>(rank, 1) - 1] / 1000.;
+    };
+
+    summary.count = count;
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+    summary.max = samples.back() / 1000.;
+    return summary;
+}
+
+void Metrics::Report(std::ostream& out)
+{
+    // Left as they were for whatever the caller writes next
+    ios_base::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+
+    out << "stage       count      p50 ms      p95 ms      p99 ms      max ms\n";
+    for (size_t ii = 0; ii < (size_t)MetricStage::count; ++ii) {
+        MetricSummary summary = Summarize((MetricStage)ii);
+        if (summary.count == 0) continue;
+
+        out << left << setw(10) << StageName((MetricStage)ii) << right << setw(7) << summary.count << fixed << setprecision(3)
+            << setw(12) << summary.p50 << setw(12) << summary.p95 << setw(12) << summary.p99 << setw(12) << summary.max << "\n";
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void Metrics::WriteCSV(const std::string& outFileLoc)
+{
+    ofstream op(outFileLoc);
+
+    op << "stage,count,p50_ms,p95_ms,p99_ms,max_ms\n";
+    for (size_t ii = 0; ii < (size_t)MetricStage::count; ++ii) {
+        MetricSummary summary = Summarize((MetricStage)ii);
+        op << StageName((MetricStage)ii) << "," << summary.count << "," << summary.p50 << "," << summary.p95 << "," << summary.p99 << "," << summary.max << "\n";
+    }
+}
+
+void Metrics::WriteJSON(const std::string& outFileLoc)
+{
+    ofstream op(outFileLoc);
+
+    op << "{\n";
+    for (size_t ii = 0; ii < (size_t)MetricStage::count; ++ii) {
+        MetricSummary summary = Summarize((MetricStage)ii);
+        op << "  \"" << StageName((MetricStage)ii) << "\": { \"count\": " << summary.count << ", \"p50_ms\": " << summary.p50 << ", \"p95_ms\": " << summary.p95
+            << ", \"p99_ms\": " << summary.p99 << ", \"max_ms\": " << summary.max << " }" << (ii + 1 < (size_t)MetricStage::count ? "," : "") << "\n";
+    }
+    op << "}\n";
+}
+
+void Metrics::InstallReportSignal()
+{
+#ifdef SIGBREAK
+    signal(SIGBREAK, OnReportSignal);
+#else
+    signal(SIGUSR1, OnReportSignal);
+#endif
+}
+
+void Metrics::ReportIfRequested(std::ostream& out)
+{
+    if (reportRequested.exchange(false))
+        Report(out);
+}
+
+void Metrics::OnReportSignal(int signalNumber)
+{
+    // Only flag it here, printing is not safe inside a signal handler
+    reportRequested.store(true);
+    // Some platforms reset the handler after delivery
+    signal(signalNumber, OnReportSignal);
+}
+
+const char* Metrics::StageName(MetricStage stage)
+{
+    switch (stage) {
+    case MetricStage::load: return "load";
+    case MetricStage::upload: return "upload";
+    case MetricStage::trace: return "trace";
+    case MetricStage::denoise: return "denoise";
+    case MetricStage::readback: return "readback";
+    case MetricStage::display: return "display";
+    case MetricStage::fileExport: return "export";
+    case MetricStage::frame: return "frame";
+    default: return "unknown";
+    }
+}
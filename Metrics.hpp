@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+enum class MetricStage : size_t {
+    load,
+    upload,
+    trace,
+    denoise,
+    readback,
+    display,
+    fileExport,
+    // Render plus display of one interactive frame
+    frame,
+    count
+};
+
+// Milliseconds
+struct MetricSummary {
+    size_t count = 0;
+    double p50 = 0., p95 = 0., p99 = 0., max = 0.;
+};
+
+// Always-on timing samples. Recording is lock-free and does no I/O, statistics are only computed when reported.
+class Metrics
+{
+public:
+    static void Record(MetricStage stage, uint64_t microseconds);
+
+    // Covers the most recent Capacity samples of the stage
+    static MetricSummary Summarize(MetricStage stage);
+
+    static void Report(std::ostream& out);
+    static void WriteCSV(const std::string& outFileLoc);
+    static void WriteJSON(const std::string& outFileLoc);
+
+    // Ctrl+Break on Windows, SIGUSR1 elsewhere, requests a report. Every render loop polls ReportIfRequested() once per
+    // frame, job or idle wake-up, so the report is written by the thread that owns the stream.
+    static void InstallReportSignal();
+    static void ReportIfRequested(std::ostream& out);
+
+    static const char* StageName(MetricStage stage);
+
+private:
+    static const size_t Capacity = 4096;
+
+    struct Ring {
+        std::atomic<uint64_t> writeIndex;
+        std::atomic<uint32_t> samples[Capacity];
+    };
+
+    static Ring rings[(size_t)MetricStage::count];
+    static std::atomic<bool> reportRequested;
+
+    static void OnReportSignal(int signalNumber);
+};
+
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(MetricStage stage) : stage(stage), startTime(std::chrono::steady_clock::now()) { }
+    ~ScopedTimer() {
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+        Metrics::Record(stage, (uint64_t)duration.count());
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    MetricStage stage;
+    std::chrono::steady_clock::time_point startTime;
+};
@@ -8,6 +8,11 @@ ObjectData::ObjectData(PrimativeType type, Material& mat, glm::mat4 mv) :
     mvInverseTranspose(glm::transpose(mvInverse)),
     type(type) { }
 
+void ObjectData::SetTransform(const glm::mat4& mv) {
+    this->mv = mv;
+    mvInverse = glm::inverse(mv);
+    mvInverseTranspose = glm::transpose(mvInverse);
+}
 
 void ObjectData::Raycast(Ray3D ray, HitRecord& hit) const {
     ray.start = mvInverse * ray.start;
@@ -16,6 +16,9 @@ public:
 
     void Raycast(Ray3D ray, HitRecord& hit) const;
 
+    // Replaces mv and keeps its inverses in sync
+    void SetTransform(const glm::mat4& mv);
+
     Material mat;
     glm::mat4 mv, mvInverse, mvInverseTranspose;
     PrimativeType type;
@@ -7,22 +7,98 @@
 #include <vector>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include "Light.hpp"
 #include "SceneLoader.hpp"
+#include "Camera.hpp"
 #include "IRaytracer.hpp"
 #include "OpenCLRaytracer.hpp"
 
 #include "PPMExporter.hpp"
 #include "OpenGLView.hpp"
+#include "Metrics.hpp"
+#include "RenderFarm.hpp"
+#include "SequenceRenderer.hpp"
 
-Ray3D screenSpaceToViewSpace(float width, float height, glm::vec2 pos, float angle) {
-    float halfWidth = width / 2.0f;
-    float halfHeight = height / 2.0f;
-    float aspect = width / height;
+// WASD moves, Q/E moves down/up and the arrow keys turn. Returns whether the camera changed.
+bool moveCamera(OpenGLView& view, Camera& camera, float deltaTime) {
+    const float moveSpeed = 5.f, turnSpeed = 1.5f;
 
-    Ray3D out = Ray3D(glm::vec3(0, 0, 0), glm::vec3(pos.x - halfWidth, pos.y - halfHeight,
-        -(halfHeight / tan(angle))));
-    return out;
+    glm::vec3 move(0.f, 0.f, 0.f);
+    float turnYaw = 0.f, turnPitch = 0.f;
+
+    if (view.IsKeyDown(GLFW_KEY_W)) move.z -= 1.f;
+    if (view.IsKeyDown(GLFW_KEY_S)) move.z += 1.f;
+    if (view.IsKeyDown(GLFW_KEY_A)) move.x -= 1.f;
+    if (view.IsKeyDown(GLFW_KEY_D)) move.x += 1.f;
+    if (view.IsKeyDown(GLFW_KEY_Q)) move.y -= 1.f;
+    if (view.IsKeyDown(GLFW_KEY_E)) move.y += 1.f;
+    if (view.IsKeyDown(GLFW_KEY_LEFT)) turnYaw += 1.f;
+    if (view.IsKeyDown(GLFW_KEY_RIGHT)) turnYaw -= 1.f;
+    if (view.IsKeyDown(GLFW_KEY_UP)) turnPitch += 1.f;
+    if (view.IsKeyDown(GLFW_KEY_DOWN)) turnPitch -= 1.f;
+
+    if (move == glm::vec3(0.f, 0.f, 0.f) && turnYaw == 0.f && turnPitch == 0.f) return false;
+
+    camera.position += glm::vec3(camera.CameraToScene() * glm::vec4(move, 0.f)) * moveSpeed * deltaTime;
+    camera.yaw += turnYaw * turnSpeed * deltaTime;
+    camera.pitch = glm::clamp(camera.pitch + turnPitch * turnSpeed * deltaTime, -1.5f, 1.5f);
+    return true;
+}
+
+inline bool materialsEqual(const Material& lhs, const Material& rhs) {
+    return lhs.ambient == rhs.ambient && lhs.diffuse == rhs.diffuse && lhs.specular == rhs.specular
+        && lhs.absorption == rhs.absorption && lhs.reflection == rhs.reflection && lhs.transparency == rhs.transparency
+        && lhs.shininess == rhs.shininess;
+}
+
+inline bool lightsEqual(const Light& lhs, const Light& rhs) {
+    return lhs.ambient == rhs.ambient && lhs.diffuse == rhs.diffuse && lhs.specular == rhs.specular && lhs.lightPosition == rhs.lightPosition;
+}
+
+// Re-reads the scene file and invalidates only what changed. Object and light counts must stay the same.
+void reloadScene(const std::string& sceneFileLoc, std::vector<ObjectData>& objects, std::vector<Light>& lights, IRaytracer& raytracer) {
+    std::vector<ObjectData> newObjects;
+    std::vector<Light> newLights;
+
+    try {
+        SceneLoader loader;
+        loader.Load(sceneFileLoc, newObjects, newLights);
+    }
+    catch (std::exception err) {
+        std::cout << err.what() << std::endl;
+        return;
+    }
+
+    if (newObjects.size() != objects.size() || newLights.size() != lights.size()) {
+        std::cout << "Object or light count changed, restart to load the new scene.\n";
+        return;
+    }
+
+    bool geometryChanged = false, materialsChanged = false, lightsChanged = false;
+    for (size_t ii = 0; ii < objects.size(); ++ii) {
+        geometryChanged |= newObjects[ii].type != objects[ii].type || newObjects[ii].mv != objects[ii].mv;
+        materialsChanged |= !materialsEqual(newObjects[ii].mat, objects[ii].mat);
+    }
+    for (size_t ii = 0; ii < lights.size(); ++ii) {
+        lightsChanged |= !lightsEqual(newLights[ii], lights[ii]);
+    }
+
+    objects = newObjects;
+    lights = newLights;
+
+    if (geometryChanged) raytracer.Invalidate(SceneChange::geometry);
+    if (materialsChanged) raytracer.Invalidate(SceneChange::materials);
+    if (lightsChanged) raytracer.Invalidate(SceneChange::lights);
+}
+
+void reportMetrics(const std::string& metricsFileLoc) {
+    Metrics::Report(std::cout);
+
+    if (metricsFileLoc.size() >= 5 && metricsFileLoc.compare(metricsFileLoc.size() - 5, 5, ".json") == 0)
+        Metrics::WriteJSON(metricsFileLoc);
+    else if (!metricsFileLoc.empty())
+        Metrics::WriteCSV(metricsFileLoc);
 }
 
 int main(int argc, char** argv) {
@@ -31,28 +107,170 @@ int main(int argc, char** argv) {
     int width = 2560, height = 1440;
     float fov = glm::radians(60.f);
     fov *= 0.5f;
-    // TODO: add flag for output file
-    std::string outFileLoc = "render.ppm";
+    const unsigned int maxBounces = 30;
+    std::string outFileLoc;
+    std::string metricsFileLoc;
+
+    std::string sceneFileLoc;
+    DenoiseSettings denoiseSettings;
+    OutputSettings outputSettings;
+    TemporalSettings temporalSettings;
+    LightSamplingSettings lightSamplingSettings;
+    QualitySettings qualitySettings;
+    StreamingSettings streamingSettings;
+    LaunchMode launchMode = LaunchMode::perPixel;
+    bool exportHeatmap = false;
+    // Side of the cube faces rendered with --cubemap, 0 renders interactively
+    size_t cubemapSize = 0;
+    FrameBudgetSettings budgetSettings;
+    FarmSettings farmSettings;
+    SequenceSettings sequenceSettings;
+    bool renderSequence = false;
+    bool farmCoordinator = false;
+    std::string workerHost;
+
+    for (int argIndex = 1; argIndex < argc; ++argIndex) {
+        std::string arg = argv[argIndex];
 
-    if (argc > 2) {
+        if (arg == "--denoise") {
+            std::string mode = (argIndex + 1 < argc) ? argv[++argIndex] : "";
+            if (mode == "device") denoiseSettings.mode = DenoiseMode::device;
+            else if (mode == "host") denoiseSettings.mode = DenoiseMode::host;
+            else {
+                std::cout << "--denoise expects 'device' or 'host'\n";
+                return 1;
+            }
+        }
+        else if (arg == "--format") {
+            std::string format = (argIndex + 1 < argc) ? argv[++argIndex] : "";
+            if (format == "rgba8") outputSettings.format = PixelFormat::rgba8;
+            else if (format == "rgb10a2") outputSettings.format = PixelFormat::rgb10a2;
+            else if (format == "rgba16f") outputSettings.format = PixelFormat::rgba16f;
+            else if (format == "rgba32f") outputSettings.format = PixelFormat::rgba32f;
+            else {
+                std::cout << "--format expects 'rgba8', 'rgb10a2', 'rgba16f' or 'rgba32f'\n";
+                return 1;
+            }
+        }
+        else if (arg == "--temporal") {
+            temporalSettings.enabled = true;
+        }
+        else if (arg == "--persistent") {
+            launchMode = LaunchMode::persistentThreads;
+        }
+        else if (arg == "--heatmap") {
+            exportHeatmap = true;
+        }
+        else if (arg == "--chunk-objects" && argIndex + 1 < argc) {
+            streamingSettings.chunkObjects = (size_t)std::stoull(argv[++argIndex]);
+        }
+        else if (arg == "--light-samples" && argIndex + 1 < argc) {
+            lightSamplingSettings.samples = (cl_uint)std::stoul(argv[++argIndex]);
+        }
+        else if (arg == "--target-fps" && argIndex + 1 < argc) {
+            float targetFps = std::stof(argv[++argIndex]);
+            if (!(targetFps > 0.f)) {
+                std::cout << "--target-fps expects a rate above 0\n";
+                return 1;
+            }
+            budgetSettings.targetFrameTime = 1000.f / targetFps;
+        }
+        else if (arg == "--roulette" && argIndex + 1 < argc) {
+            qualitySettings.rouletteThreshold = std::stof(argv[++argIndex]);
+        }
+        else if (arg == "--reinhard") {
+            outputSettings.toneMapping = ToneMapping::reinhard;
+        }
+        else if (arg == "--gamma" && argIndex + 1 < argc) {
+            outputSettings.gamma = std::stof(argv[++argIndex]);
+            // Packing divides by it, and a negative gamma would invert the curve
+            if (!(outputSettings.gamma > 0.f)) {
+                std::cout << "--gamma expects a value above 0\n";
+                return 1;
+            }
+        }
+        else if (arg == "--output" && argIndex + 1 < argc) {
+            outFileLoc = argv[++argIndex];
+        }
+        else if (arg == "--metrics" && argIndex + 1 < argc) {
+            metricsFileLoc = argv[++argIndex];
+        }
+        else if (arg == "--sequence" && argIndex + 1 < argc) {
+            renderSequence = true;
+            sequenceSettings.frameCount = (size_t)std::stoul(argv[++argIndex]);
+        }
+        else if (arg == "--cubemap" && argIndex + 1 < argc) {
+            cubemapSize = (size_t)std::stoul(argv[++argIndex]);
+        }
+        else if (arg == "--fps" && argIndex + 1 < argc) {
+            sequenceSettings.framesPerSecond = std::stof(argv[++argIndex]);
+        }
+        else if (arg == "--farm" && argIndex + 1 < argc) {
+            farmCoordinator = true;
+            farmSettings.port = (uint16_t)std::stoi(argv[++argIndex]);
+        }
+        else if (arg == "--tile" && argIndex + 1 < argc) {
+            farmSettings.tileSize = (uint32_t)std::stoi(argv[++argIndex]);
+        }
+        else if (arg == "--worker" && argIndex + 1 < argc) {
+            workerHost = argv[++argIndex];
+        }
+        else if (sceneFileLoc.empty()) {
+            sceneFileLoc = arg;
+        }
+        else {
+            std::cout << "Usage: OpenCL-Raytracer [--denoise <device|host>] [--temporal] [--light-samples <count>] [--chunk-objects <count>] [--persistent] [--heatmap] [--target-fps <fps>] [--roulette <threshold>] [--format <rgba8|rgb10a2|rgba16f|rgba32f>] [--reinhard] [--gamma <gamma>] [--output <file.ppm>] [--metrics <file.csv|file.json>] [--sequence <frames, 0 for the whole animation> [--fps <rate>]] [--cubemap <size>] [--farm <port> [--tile <size>]] <scene file>\n"
+                << "       OpenCL-Raytracer --worker <host:port>\n";
+            return 1;
+        }
+    }
+
+    // The scene is shipped to the workers once, so they have no way to follow an animation
+    if (farmCoordinator && renderSequence) {
+        std::cout << "--farm cannot be combined with --sequence\n";
         return 1;
     }
 
-    std::string sceneFileLoc;
-    if (argc < 2) {
+    // Costs are only read back from the interactive raytracer, the headless modes would drop them
+    if (exportHeatmap && (renderSequence || farmCoordinator || cubemapSize > 0 || !workerHost.empty())) {
+        std::cout << "--heatmap cannot be combined with --sequence, --farm, --worker or --cubemap\n";
+        return 1;
+    }
+
+    Metrics::InstallReportSignal();
+
+    if (!workerHost.empty()) {
+        // Workers get the scene and everything else from the coordinator
+        size_t portSeparator = workerHost.rfind(':');
+        if (portSeparator == std::string::npos) {
+            std::cout << "--worker expects <host:port>\n";
+            return 1;
+        }
+
+        try {
+            RenderWorker worker(workerHost.substr(0, portSeparator), (uint16_t)std::stoi(workerHost.substr(portSeparator + 1)));
+            worker.Run();
+        }
+        catch (std::exception& err) {
+            std::cout << err.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (sceneFileLoc.empty()) {
         std::cout << "Enter the scene file to render:\n";
         std::cin >> sceneFileLoc;
     }
-    else {
-        sceneFileLoc = argv[1];
-    }
 
     std::vector<ObjectData> objects;
     std::vector<Light> lights;
+    SceneAnimation animation;
 
     try {
+        ScopedTimer timer(MetricStage::load);
         SceneLoader loader;
-        loader.Load(sceneFileLoc, objects, lights);
+        loader.Load(sceneFileLoc, objects, lights, animation);
     }
     catch (std::exception err) {
         std::cout << err.what() << std::endl;
@@ -61,44 +279,220 @@ int main(int argc, char** argv) {
 
     std::cout << "Scene file loaded without any errors.\n";
 
+    Camera camera(width, height, fov);
+
+    if (farmCoordinator) {
+        // Headless, the frame is split across the workers and written straight to the output file
+        if (outFileLoc.empty()) {
+            std::cout << "--farm needs an --output file\n";
+            return 1;
+        }
+
+        std::vector<uint8_t> pixels;
+        Frame frame;
+        {
+            FarmRenderSettings renderSettings;
+            renderSettings.output = outputSettings;
+            renderSettings.denoise = denoiseSettings;
+            renderSettings.temporal = temporalSettings;
+            renderSettings.lightSampling = lightSamplingSettings;
+            renderSettings.quality = qualitySettings;
+
+            RenderCoordinator coordinator(objects, lights, width, height, fov, maxBounces, renderSettings, farmSettings);
+
+            ScopedTimer timer(MetricStage::frame);
+            coordinator.RenderFrame(camera, pixels, frame);
+        }
+
+        {
+            ScopedTimer timer(MetricStage::fileExport);
+            PPMExporter::ExportP3(outFileLoc, frame);
+        }
+
+        reportMetrics(metricsFileLoc);
+        return 0;
+    }
+
+    // Cubemaps only trace the faces, so the main frame's buffers are sized to one face rather than the window
+    if (cubemapSize > 0) {
+        width = height = (int)cubemapSize;
+        camera.width = camera.height = cubemapSize;
+    }
+
     std::vector<Ray3D> rays;
     std::vector<HitRecord> rayHits(height * width);
-    std::vector<float> pixelData(height * width * 3);
-    
-    for (int jj = 0; jj < height; ++jj) {
-        for (int ii = 0; ii < width; ++ii) {
-            rays.emplace_back(screenSpaceToViewSpace((float)width, (float)height, glm::vec2(ii, height - jj), fov));
+    camera.GenerateRays(rays);
+
+    //IRaytracer* raytracer = (IRaytracer*)new CPURaytracer();
+    // Owned until main returns, after every export that reads its last frame and costs
+    std::unique_ptr<OpenCLRaytracer> openCLRaytracer = std::make_unique<OpenCLRaytracer>(objects, lights, rays, width, height, maxBounces, streamingSettings);
+    openCLRaytracer->SetLaunchMode(launchMode);
+    openCLRaytracer->SetCostRecording(exportHeatmap);
+    IRaytracer* raytracer = (IRaytracer*)openCLRaytracer.get();
+    raytracer->SetDenoiseSettings(denoiseSettings);
+    raytracer->SetOutputSettings(outputSettings);
+    raytracer->SetTemporalSettings(temporalSettings);
+    raytracer->SetLightSamplingSettings(lightSamplingSettings);
+    raytracer->SetQualitySettings(qualitySettings);
+    raytracer->SetCamera(camera);
+
+    if (cubemapSize > 0) {
+        // Headless, the six faces around the camera are traced together and written to numbered output files
+        if (outFileLoc.empty()) {
+            std::cout << "--cubemap needs an --output file\n";
+            return 1;
+        }
+
+        // +X, -X, +Y, -Y, +Z, -Z, the camera looks down -Z at no yaw or pitch
+        const float faceAngles[6][2] = { { -90.f, 0.f }, { 90.f, 0.f }, { 0.f, 90.f }, { 0.f, -90.f }, { 180.f, 0.f }, { 0.f, 0.f } };
+        std::vector<Camera> faces;
+        for (const auto& angles : faceAngles) {
+            // 90 degrees across, so the faces meet without overlap
+            Camera face(cubemapSize, cubemapSize, glm::radians(45.f));
+            face.position = camera.position;
+            face.yaw = glm::radians(angles[0]);
+            face.pitch = glm::radians(angles[1]);
+            faces.push_back(face);
+        }
+
+        try {
+            const std::vector<Frame>& frames = openCLRaytracer->RenderViews(faces);
+
+            ScopedTimer timer(MetricStage::fileExport);
+            for (size_t face = 0; face < frames.size(); ++face) {
+                PPMExporter::ExportP3(SequenceRenderer::FramePath(outFileLoc, face), frames[face]);
+            }
         }
+        catch (std::exception& err) {
+            std::cout << err.what() << std::endl;
+            return 1;
+        }
+
+        reportMetrics(metricsFileLoc);
+        return 0;
     }
 
-    //IRaytracer* raytracer = (IRaytracer*)new CPURaytracer();
-    IRaytracer* raytracer = (IRaytracer*)new OpenCLRaytracer(objects, lights, rays, 30);
+    if (renderSequence) {
+        // Headless, every frame goes straight to a numbered output file
+        if (outFileLoc.empty()) {
+            std::cout << "--sequence needs an --output file\n";
+            return 1;
+        }
+
+        sequenceSettings.outFileLoc = outFileLoc;
+        SequenceRenderer sequence(*raytracer, animation, objects, lights);
+        sequence.Render(sequenceSettings);
+
+        reportMetrics(metricsFileLoc);
+        return 0;
+    }
 
     OpenGLView view;
 
     view.SetUpWindow(width, height);
 
+    // Pixels stay valid until the next Render()
+    Frame lastFrame;
+
+    FrameBudgetController budget(budgetSettings, maxBounces);
+    // Set while showing a full quality frame rendered after the camera came to rest
+    bool showingRefinedFrame = false;
+
+    // Rays are traced at a fraction of the window resolution and stretched by the view
+    auto applyQuality = [&](cl_uint bounceLimit, float resolutionScale) {
+        QualitySettings quality = qualitySettings;
+        quality.bounceLimit = bounceLimit;
+        // Interactive frames trade some noise for ending paths early, the full quality refine does not
+        if (bounceLimit < maxBounces || resolutionScale < 1.f)
+            quality.rouletteThreshold = glm::max(quality.rouletteThreshold, budgetSettings.rouletteThreshold);
+        raytracer->SetQualitySettings(quality);
+
+        Camera renderCamera = camera;
+        renderCamera.width = glm::max((size_t)(width * resolutionScale), (size_t)1);
+        renderCamera.height = glm::max((size_t)(height * resolutionScale), (size_t)1);
+        renderCamera.GenerateRays(rays);
+        raytracer->SetCamera(renderCamera);
+    };
+
+    auto lastLoopTime = std::chrono::high_resolution_clock::now();
+
     while (!view.ShouldWindowClose()) {
-#if _DEBUG
-        auto startTime = std::chrono::high_resolution_clock::now();
-#endif
+        auto loopTime = std::chrono::high_resolution_clock::now();
+        // Clamped so a long idle wait doesn't turn into a jump
+        float deltaTime = glm::min(std::chrono::duration<float>(loopTime - lastLoopTime).count(), 0.1f);
+        lastLoopTime = loopTime;
+
+        Metrics::ReportIfRequested(std::cout);
+
+        if (view.ConsumeKeyPress(GLFW_KEY_R))
+            reloadScene(sceneFileLoc, objects, lights, *raytracer);
 
-        auto pixelData = raytracer->Render();
-        view.Display(pixelData);
+        if (moveCamera(view, camera, deltaTime)) {
+            showingRefinedFrame = false;
+            applyQuality(budget.BounceLimit(), budget.ResolutionScale());
+        }
+
+        // Spend the first idle moment on one frame at full quality
+        if (raytracer->IsFrameCurrent() && budget.IsEnabled() && !budget.IsFullQuality() && !showingRefinedFrame) {
+            showingRefinedFrame = true;
+            applyQuality(maxBounces, 1.f);
+        }
 
-#if _DEBUG
-        auto endTime = std::chrono::high_resolution_clock::now();
+        if (raytracer->IsFrameCurrent()) {
+            // Nothing to re-render, sleep until input arrives or the window needs repainting.
+            // Wakes up now and then to write a requested report.
+            if (view.ConsumeRefresh()) {
+                ScopedTimer timer(MetricStage::display);
+                view.Display(lastFrame);
+            }
+            else
+                view.WaitEvents(0.2);
+            continue;
+        }
 
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+        {
+            ScopedTimer frameTimer(MetricStage::frame);
+
+            lastFrame = raytracer->Render();
+
+            ScopedTimer displayTimer(MetricStage::display);
+            view.Display(lastFrame);
+        }
 
-        std::cout << "Frame finished in " << duration.count() << "ms.\n";
-#endif
+        // Only interactive traces count against the budget. Display waits on the swap interval, which no quality setting shortens.
+        float traceTime = openCLRaytracer->LastTraceTime();
+        if (!showingRefinedFrame && traceTime > 0.f && budget.Update(traceTime))
+            applyQuality(budget.BounceLimit(), budget.ResolutionScale());
     }
 
 
     view.TearDownWindow();
 
-    //PPMExporter::ExportP3(outFileLoc, width, height, pixelData);
+    if (!outFileLoc.empty()) {
+        ScopedTimer timer(MetricStage::fileExport);
+        PPMExporter::ExportP3(outFileLoc, lastFrame);
+    }
+
+    // Costs belong to the last traced frame, which is the one exported above
+    if (exportHeatmap) {
+        const std::vector<PixelCost>& costs = openCLRaytracer->PixelCosts();
+        if (costs.empty()) {
+            std::cout << "No per-pixel costs were recorded, out-of-core tracing does not record them\n";
+        }
+        else {
+            CostHeatmap::Report(std::cout, costs);
+            if (!outFileLoc.empty()) {
+                std::vector<uint8_t> heatmapPixels;
+                Frame heatmap;
+                CostHeatmap::Build(costs, lastFrame.width, lastFrame.height, heatmapPixels, heatmap);
+
+                ScopedTimer timer(MetricStage::fileExport);
+                PPMExporter::ExportP3(CostHeatmap::HeatmapPath(outFileLoc), heatmap);
+            }
+        }
+    }
+
+    reportMetrics(metricsFileLoc);
 
     return 0;
 }
\ No newline at end of file
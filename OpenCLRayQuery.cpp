@@ -0,0 +1,107 @@
+#include "OpenCLRayQuery.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/compute/system.hpp>
+
+using namespace std;
+
+// Caller rays and hits are copied to and from the device as they are
+static_assert(sizeof(Ray3D) == 2 * sizeof(cl_float4), "Ray3D must match Ray in hittest_kernel.cl");
+static_assert(sizeof(RayHit) == 32, "RayHit must match RayHit in hittest_kernel.cl");
+
+// Larger batches are cast in slices of this many rays, bounding the device memory a query needs
+static const size_t MaxSliceRays = (size_t)1 << 20;
+
+OpenCLRayQuery::OpenCLRayQuery(const std::vector<ObjectData>& objects) : IRayQuery(objects), OBJECT_COUNT(objects.size())
+{
+    CreateKernel();
+
+    // Kept non-empty so the kernel argument is always valid
+    objs_mem_obj = boost::compute::buffer(context, std::max<size_t>((size_t)OBJECT_COUNT, 1) * sizeof(cl_ObjectData), CL_MEM_READ_ONLY);
+    kernel.set_arg(1, sizeof(cl_mem), (void*)&objs_mem_obj);
+}
+
+OpenCLRayQuery::OpenCLRayQuery(const std::vector<ObjectData>& objects, OpenCLRaytracer& raytracer) : IRayQuery(objects), OBJECT_COUNT(objects.size()), sceneSource(&raytracer)
+{
+    // The raytracer's objects buffer is bound by each query, it may be replaced or changed in between
+    CreateKernel();
+}
+
+void OpenCLRayQuery::CreateKernel()
+{
+    boost::compute::device gpu = boost::compute::system::default_device();
+    context = boost::compute::system::default_context();
+    command_queue = boost::compute::command_queue(context, gpu);
+
+    program = boost::compute::program::create_with_source_file("hittest_kernel.cl", context);
+    program.build();
+    kernel = program.create_kernel("hittest");
+
+    kernel.set_arg(0, sizeof(cl_ulong), &OBJECT_COUNT);
+    // Ray and hit buffers are set once a batch sizes them, see ReserveRays()
+}
+
+OpenCLRayQuery::~OpenCLRayQuery() {
+    command_queue.finish();
+}
+
+void OpenCLRayQuery::Query(const Ray3D* rays, size_t count, RayQueryMode mode, RayHit* o_hits, float maxTime)
+{
+    if (objects.size() != OBJECT_COUNT)
+        throw std::runtime_error("Object count cannot change after the ray query is created.");
+
+    boost::compute::wait_list uploaded;
+    if (sceneSource) {
+        boost::compute::event sceneUploaded;
+        objs_mem_obj = sceneSource->SharedObjects(sceneUploaded);
+        kernel.set_arg(1, sizeof(cl_mem), (void*)&objs_mem_obj);
+        uploaded.insert(sceneUploaded);
+    }
+    else if (loadedVersion != version) {
+        UploadObjects();
+    }
+
+    if (count == 0) return;
+    ReserveRays(std::min(count, MaxSliceRays));
+
+    cl_uint anyHit = (mode == RayQueryMode::anyHit) ? 1 : 0;
+    kernel.set_arg(4, sizeof(cl_uint), &anyHit);
+    kernel.set_arg(5, sizeof(cl_float), &maxTime);
+
+    // The queue is in order, so each slice's upload waits for the previous slice's hits to be read back
+    for (size_t first = 0; first < count; first += MaxSliceRays) {
+        cl_uint sliceRays = (cl_uint)std::min(count - first, MaxSliceRays);
+        kernel.set_arg(3, sizeof(cl_uint), &sliceRays);
+
+        command_queue.enqueue_write_buffer_async(rays_mem_obj, 0, sliceRays * sizeof(Ray3D), rays + first);
+        command_queue.enqueue_1d_range_kernel(kernel, 0, sliceRays, 0, uploaded);
+        command_queue.enqueue_read_buffer_async(hits_mem_obj, 0, sliceRays * sizeof(RayHit), o_hits + first);
+    }
+
+    command_queue.finish();
+}
+
+void OpenCLRayQuery::UploadObjects()
+{
+    objArr.resize((size_t)OBJECT_COUNT);
+    for (size_t i = 0; i < OBJECT_COUNT; i++) {
+        objArr[i] = cl_ObjectData(objects[i]);
+    }
+
+    if (OBJECT_COUNT > 0)
+        command_queue.enqueue_write_buffer(objs_mem_obj, 0, objArr.size() * sizeof(cl_ObjectData), objArr.data());
+    loadedVersion = version;
+}
+
+void OpenCLRayQuery::ReserveRays(size_t count)
+{
+    if (count <= rayCapacity) return;
+
+    rays_mem_obj = boost::compute::buffer(context, count * sizeof(Ray3D), CL_MEM_READ_ONLY);
+    hits_mem_obj = boost::compute::buffer(context, count * sizeof(RayHit), CL_MEM_WRITE_ONLY);
+    kernel.set_arg(2, sizeof(cl_mem), (void*)&rays_mem_obj);
+    kernel.set_arg(6, sizeof(cl_mem), (void*)&hits_mem_obj);
+    rayCapacity = count;
+}
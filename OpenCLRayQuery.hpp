@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include "IRayQuery.hpp"
+#include "CLSceneTypes.hpp"
+#include "OpenCLRaytracer.hpp"
+
+#include <boost/compute/buffer.hpp>
+#include <boost/compute/context.hpp>
+#include <boost/compute/command_queue.hpp>
+#include <boost/compute/program.hpp>
+#include <boost/compute/kernel.hpp>
+
+// Ray queries on the default device through hittest_kernel.cl. Batches run on a queue of their own so they can be
+// issued alongside a raytracer's frames.
+class OpenCLRayQuery : public IRayQuery
+{
+public:
+    // Standalone, the objects are uploaded by the query and stay on the device until invalidated
+    OpenCLRayQuery(const std::vector<ObjectData>& objects);
+    // Over the scene already loaded by raytracer, which keeps its objects up to date. objects must be the vector the
+    // raytracer was created with, changes are announced to the raytracer rather than through Invalidate().
+    OpenCLRayQuery(const std::vector<ObjectData>& objects, OpenCLRaytracer& raytracer);
+    ~OpenCLRayQuery();
+
+    // Inherited via IRayQuery
+    using IRayQuery::Query;
+    virtual void Query(const Ray3D* rays, size_t count, RayQueryMode mode, RayHit* o_hits, float maxTime = MAX_FLOAT) override;
+
+private:
+    void CreateKernel();
+    void UploadObjects();
+    // Grows the ray and hit buffers to hold at least count rays
+    void ReserveRays(size_t count);
+
+    const cl_ulong OBJECT_COUNT;
+    size_t rayCapacity = 0;
+
+    // Set when querying a raytracer's objects rather than a copy of our own
+    OpenCLRaytracer* sceneSource = nullptr;
+    std::vector<cl_ObjectData> objArr;
+
+    boost::compute::buffer objs_mem_obj;
+    boost::compute::buffer rays_mem_obj;
+    boost::compute::buffer hits_mem_obj;
+
+    boost::compute::context context;
+    boost::compute::command_queue command_queue;
+    boost::compute::program program;
+    boost::compute::kernel kernel;
+};
@@ -1,7 +1,11 @@
 #include "OpenCLRaytracer.hpp"
+#include "Metrics.hpp"
 
 #include <iostream>
+#include <algorithm>
 #include <chrono>
+#include <stdexcept>
+#include <utility>
 #include <stdio.h>
 
 #include <windows.h>
@@ -10,28 +14,25 @@
 
 using namespace std;
 
-OpenCLRaytracer::OpenCLRaytracer(const std::vector<ObjectData>& objects, const std::vector<Light>& lights, const std::vector<Ray3D>& rays, const unsigned int MAX_BOUNCES)
-    : IRaytracer(objects, lights, rays), MAX_BOUNCES(MAX_BOUNCES), OBJECT_COUNT(objects.size()), LIGHT_COUNT(lights.size()), RAYCAST_COUNT(rays.size())
-{
-    objArr.reserve((size_t)OBJECT_COUNT);
-    for (int i = 0; i < OBJECT_COUNT; i++) {
-        objArr.emplace_back(objects[i]);
-    }
-
-    lightArr.reserve((size_t)LIGHT_COUNT);
-    for (int i = 0; i < LIGHT_COUNT; i++) {
-        lightArr.emplace_back(lights[i]);
-    }
-
-    rayArr.reserve((size_t)RAYCAST_COUNT);
-
-    pixelDataArr = new cl_float3[(size_t)RAYCAST_COUNT];
-    for (int i = 0; i < RAYCAST_COUNT; i++) {
-        rayArr.emplace_back(rays[i]);
-
-        pixelDataArr[i] = { 0.f, 0.f, 0.f, 1.f };
+static const char* packKernelName(PixelFormat format) {
+    switch (format) {
+    case PixelFormat::rgba32f:
+        return "pack_rgba32f";
+    case PixelFormat::rgba16f:
+        return "pack_rgba16f";
+    case PixelFormat::rgb10a2:
+        return "pack_rgb10a2";
+    case PixelFormat::rgba8:
+    default:
+        return "pack_rgba8";
     }
+}
 
+OpenCLRaytracer::OpenCLRaytracer(const std::vector<ObjectData>& objects, const std::vector<Light>& lights, const std::vector<Ray3D>& rays, size_t width, size_t height, const unsigned int MAX_BOUNCES,
+    const StreamingSettings& streamingSettings)
+    : IRaytracer(objects, lights, rays, width, height), MAX_BOUNCES(MAX_BOUNCES), OBJECT_COUNT(objects.size()), LIGHT_COUNT(lights.size()), RAYCAST_COUNT(rays.size()),
+    tuner(boost::compute::system::default_device()), transfer(boost::compute::system::default_device(), command_queue)
+{
     // Get platform and device information
     boost::compute::device gpu = boost::compute::system::default_device();
 
@@ -43,11 +44,41 @@ OpenCLRaytracer::OpenCLRaytracer(const std::vector<ObjectData>& objects, const s
     // Create a command queue
     command_queue = boost::compute::system::default_queue();
 
-    // Create memory buffers on the device for each vector 
-    objs_mem_obj = boost::compute::buffer(context, (size_t)OBJECT_COUNT * sizeof(cl_ObjectData), CL_MEM_READ_ONLY);
-    lights_mem_obj = boost::compute::buffer(context, (size_t)LIGHT_COUNT * sizeof(cl_Light), CL_MEM_READ_ONLY);
-    rays_mem_obj = boost::compute::buffer(context, (size_t)RAYCAST_COUNT * sizeof(cl_Ray), CL_MEM_READ_ONLY);
-    pixelData_mem_obj = boost::compute::buffer(context, (size_t)RAYCAST_COUNT * sizeof(cl_ObjectData), CL_MEM_WRITE_ONLY);
+    // Scenes that don't fit get two chunk buffers of at most a quarter of the device's memory each
+    chunkObjects = streamingSettings.chunkObjects;
+    cl_ulong objectBudget = std::min<cl_ulong>(gpu.get_info<cl_ulong>(CL_DEVICE_MAX_MEM_ALLOC_SIZE), gpu.global_memory_size() / 4);
+    if (chunkObjects == 0 && (cl_ulong)OBJECT_COUNT * sizeof(cl_ObjectData) > objectBudget)
+        chunkObjects = std::max<size_t>((size_t)(objectBudget / sizeof(cl_ObjectData)), 1);
+    streaming = chunkObjects > 0 && chunkObjects < OBJECT_COUNT;
+
+    // Create memory buffers on the device for each vector, the host writes or reads every one made through transfer
+    if (streaming) {
+        for (boost::compute::buffer& chunk_mem_obj : chunk_mem_objs) {
+            chunk_mem_obj = boost::compute::buffer(context, chunkObjects * sizeof(cl_ObjectData), CL_MEM_READ_ONLY);
+        }
+        // Uploads go through their own queue so they can run alongside the tracing
+        upload_queue = boost::compute::command_queue(context, gpu);
+    }
+    else {
+        objs_mem_obj = transfer.Create(context, (size_t)OBJECT_COUNT * sizeof(cl_ObjectData), CL_MEM_READ_ONLY);
+    }
+    lights_mem_obj = transfer.Create(context, (size_t)LIGHT_COUNT * sizeof(cl_Light), CL_MEM_READ_ONLY);
+    // A tree over n lights has 2n - 1 nodes, kept non-empty so the kernel argument is always valid
+    lightNodes_mem_obj = transfer.Create(context, std::max<size_t>((size_t)LIGHT_COUNT * 2, 2) * sizeof(cl_LightNode), CL_MEM_READ_ONLY);
+    rays_mem_obj = transfer.Create(context, (size_t)RAYCAST_COUNT * sizeof(cl_Ray), CL_MEM_READ_ONLY);
+    // Colors and depths swap with their history every frame, so both sides need the same placement
+    pixelData_mem_obj = transfer.Create(context, (size_t)RAYCAST_COUNT * sizeof(cl_float4), CL_MEM_READ_WRITE);
+    prevPixelData_mem_obj = transfer.Create(context, (size_t)RAYCAST_COUNT * sizeof(cl_float4), CL_MEM_READ_WRITE);
+    depth_mem_obj = transfer.Create(context, (size_t)RAYCAST_COUNT * sizeof(cl_float), CL_MEM_READ_WRITE);
+    prevDepth_mem_obj = transfer.Create(context, (size_t)RAYCAST_COUNT * sizeof(cl_float), CL_MEM_READ_WRITE);
+    normal_mem_obj = transfer.Create(context, (size_t)RAYCAST_COUNT * sizeof(cl_float4), CL_MEM_READ_WRITE);
+    albedo_mem_obj = transfer.Create(context, (size_t)RAYCAST_COUNT * sizeof(cl_float4), CL_MEM_READ_WRITE);
+    workCounter_mem_obj = boost::compute::buffer(context, sizeof(cl_uint), CL_MEM_READ_WRITE);
+    primaryHits_mem_obj = boost::compute::buffer(context, (size_t)RAYCAST_COUNT * sizeof(cl_PrimaryHit), CL_MEM_READ_WRITE);
+    // Stands in for the cost buffer until recording is turned on, the kernel never writes it
+    costs_mem_obj = boost::compute::buffer(context, sizeof(PixelCost), CL_MEM_WRITE_ONLY);
+    denoise_mem_obj = boost::compute::buffer(context, (size_t)RAYCAST_COUNT * sizeof(cl_float4), CL_MEM_READ_WRITE);
+    denoiseScratch_mem_obj = boost::compute::buffer(context, (size_t)RAYCAST_COUNT * sizeof(cl_float4), CL_MEM_READ_WRITE);
 
     // Create a program from the kernel source
     program = boost::compute::program::create_with_source_file("shade_and_reflect_kernel.cl", context);
@@ -59,82 +90,508 @@ OpenCLRaytracer::OpenCLRaytracer(const std::vector<ObjectData>& objects, const s
     kernel = program.create_kernel("shade_and_reflect");
 
     // Set the arguments of the kernel
-    kernel.set_arg(0, sizeof(cl_uint), &MAX_BOUNCES);
     kernel.set_arg(1, sizeof(cl_uint), &OBJECT_COUNT);
-    kernel.set_arg(2, sizeof(cl_mem), (void*)&objs_mem_obj);
+    if (!streaming)
+        kernel.set_arg(2, sizeof(cl_mem), (void*)&objs_mem_obj);
     kernel.set_arg(3, sizeof(cl_uint), &LIGHT_COUNT);
     kernel.set_arg(4, sizeof(cl_mem), (void*)&lights_mem_obj);
     kernel.set_arg(5, sizeof(cl_mem), (void*)&rays_mem_obj);
-    kernel.set_arg(6, sizeof(cl_mem), (void*)&pixelData_mem_obj);
-
-    command_queue.enqueue_write_buffer(objs_mem_obj, 0, (size_t)OBJECT_COUNT * sizeof(cl_ObjectData), objArr.data());
-    command_queue.enqueue_write_buffer(lights_mem_obj, 0, (size_t)LIGHT_COUNT * sizeof(cl_Light), lightArr.data());
-    command_queue.enqueue_write_buffer(rays_mem_obj, 0, (size_t)RAYCAST_COUNT * sizeof(cl_Ray), rayArr.data());
-    command_queue.enqueue_write_buffer(pixelData_mem_obj, 0, (size_t)RAYCAST_COUNT * sizeof(cl_float3), pixelDataArr);
+    kernel.set_arg(8, sizeof(cl_mem), (void*)&normal_mem_obj);
+    kernel.set_arg(9, sizeof(cl_mem), (void*)&albedo_mem_obj);
+    kernel.set_arg(20, sizeof(cl_mem), (void*)&lightNodes_mem_obj);
+    kernel.set_arg(24, sizeof(cl_mem), (void*)&primaryHits_mem_obj);
+    kernel.set_arg(26, sizeof(cl_mem), (void*)&workCounter_mem_obj);
+    kernel.set_arg(28, sizeof(cl_mem), (void*)&costs_mem_obj);
+
+    // Persistent groups stay small enough that every compute unit can hold one
+    computeUnits = std::max<cl_uint>(gpu.compute_units(), 1);
+    maxAllocSize = gpu.get_info<cl_ulong>(CL_DEVICE_MAX_MEM_ALLOC_SIZE);
+    globalMemorySize = gpu.global_memory_size();
+    persistentGroupSize = std::min<size_t>(persistentGroupSize, kernel.get_work_group_info<size_t>(gpu, CL_KERNEL_WORK_GROUP_SIZE));
+    // Light sampling and quality arguments are set along with their changes, see UploadChanges()
+    // Color, depth and reprojection arguments change every frame, see BindFrameBuffers()
+
+    if (streaming)
+        CreateStreamingKernels();
+
+    // The denoiser only needs the static guide buffers, color in/out and depth are set per pass
+    denoiseProgram = boost::compute::program::create_with_source_file("denoise_kernel.cl", context);
+    denoiseProgram.build();
+    denoiseKernel = denoiseProgram.create_kernel("atrous_filter");
+
+    denoiseKernel.set_arg(9, sizeof(cl_mem), (void*)&normal_mem_obj);
+    denoiseKernel.set_arg(10, sizeof(cl_mem), (void*)&albedo_mem_obj);
+
+    outputProgram = boost::compute::program::create_with_source_file("output_kernel.cl", context);
+    outputProgram.build();
+
+    SetRenderSize(width, height);
+
+    transfer.Write(pixelData_mem_obj, (size_t)RAYCAST_COUNT, pixelDataArr, [&](cl_float4* dst) {
+        std::fill(dst, dst + (size_t)RAYCAST_COUNT, cl_float4{ 0.f, 0.f, 0.f, 1.f });
+    });
 }
 
 OpenCLRaytracer::~OpenCLRaytracer() {
+    // Chunk uploads read from chunkObjArr
+    if (streaming)
+        upload_queue.finish();
 
+    // Mapped frames have to be released before the queue goes away
+    transfer.UnmapAll();
+    command_queue.finish();
 }
 
-cl_float4* OpenCLRaytracer::Render()
+void OpenCLRaytracer::Submit()
 {
-#if _DEBUG
-    std::cout << "Executing kernel...\n";
+    if (submitted || IsFrameCurrent()) return;
 
-    auto startTime = std::chrono::high_resolution_clock::now();
-#endif
+    // Output settings alone only need the finished colors re-packed
+    submittedRetrace = Changed(SceneChange::geometry) || Changed(SceneChange::materials) || Changed(SceneChange::lights)
+        || Changed(SceneChange::camera) || Changed(SceneChange::denoise) || Changed(SceneChange::quality);
+    submittedVersion = version;
 
-    // Execute the OpenCL kernel on the list
-    size_t global_item_size = (size_t)RAYCAST_COUNT; // Process the entire lists
-    size_t local_item_size = 32; // Divide work items into groups of 64
-    command_queue.enqueue_1d_range_kernel(kernel, 0, global_item_size, local_item_size);
+    // The camera may ask for fewer pixels than the buffers hold
+    size_t cameraWidth = hasCamera ? camera.width : width, cameraHeight = hasCamera ? camera.height : height;
+    if (cameraWidth != renderWidth || cameraHeight != renderHeight)
+        SetRenderSize(cameraWidth, cameraHeight);
 
-    // Read the memory buffer C on the device to the local variable C
-    command_queue.enqueue_read_buffer(pixelData_mem_obj, 0, (size_t)RAYCAST_COUNT * sizeof(cl_float3), pixelDataArr);
+    {
+        ScopedTimer timer(MetricStage::upload);
+        UploadChanges();
+    }
 
-#if _DEBUG
-    auto endTime = std::chrono::high_resolution_clock::now();
+    if (submittedRetrace) {
+        traceStart = std::chrono::steady_clock::now();
+
+        // History is only valid while the scene itself is unchanged
+        bool reprojectFrame = temporalSettings.enabled && hasCamera && hasHistory
+            && !Changed(SceneChange::geometry) && !Changed(SceneChange::materials) && !Changed(SceneChange::lights) && !Changed(SceneChange::quality);
+
+        // Last frame's raw colors and depths become the history read by this one
+        std::swap(pixelData_mem_obj, prevPixelData_mem_obj);
+        std::swap(depth_mem_obj, prevDepth_mem_obj);
+        BindFrameBuffers(reprojectFrame);
+
+        submittedCosts = false;
+        if (streaming) {
+            EnqueueStreamedTrace();
+        }
+        else {
+            // Material, light and quality changes shade the cached primary hits again instead of tracing them
+            // Recorded costs have to include the primary intersection tests, so recording always traces them
+            cl_uint reusePrimaryHits = (hasPrimaryHits && !recordCost && !Changed(SceneChange::geometry) && !Changed(SceneChange::camera)) ? 1 : 0;
+            kernel.set_arg(25, sizeof(cl_uint), &reusePrimaryHits);
+
+            EnqueueTrace();
+            hasPrimaryHits = true;
+        }
+
+        tracedCamera = camera;
+        hasHistory = true;
+        ++frameIndex;
+
+        finalColor_mem_obj = (denoiseSettings.mode == DenoiseMode::device) ? EnqueueDenoise() : &pixelData_mem_obj;
+    }
 
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+    PrepareOutput();
 
-    std::cout << "Kernel finished in " << duration.count() << "ms.\n";
-#endif
+    // The host filter needs the unquantized colors, so it packs after reading them back
+    if (denoiseSettings.mode != DenoiseMode::host)
+        EnqueuePack();
 
-    return pixelDataArr;
+    // Start the device on it now rather than at the first blocking call
+    command_queue.flush();
+    submitted = true;
 }
 
+const Frame& OpenCLRaytracer::Render()
+{
+    Submit();
+    if (!submitted) return frame;
+    submitted = false;
+
+    {
+        // Only the part of the trace and device denoise the host didn't overlap with other work
+        ScopedTimer timer(MetricStage::trace);
+        command_queue.finish();
+    }
+    lastTraceTime = submittedRetrace ? std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - traceStart).count() : 0.f;
+
+    // The previous frame is given up here, Submit() never packs into the buffer still mapped for it
+    transfer.UnmapAll();
+
+    if (denoiseSettings.mode == DenoiseMode::host) {
+        if (submittedRetrace) {
+            {
+                // The raw colors are history for the next trace, so the filter works on a host copy either way
+                ScopedTimer timer(MetricStage::readback);
+                pixelDataArr.resize(RenderCount());
+                const cl_float4* pixelData = transfer.Read(pixelData_mem_obj, RenderCount(), pixelDataArr);
+                if (pixelData != pixelDataArr.data())
+                    std::copy(pixelData, pixelData + RenderCount(), pixelDataArr.begin());
+                transfer.Unmap(pixelData_mem_obj);
+            }
+
+            ScopedTimer timer(MetricStage::denoise);
+            DenoiseOnHost();
+        }
+        outputArr.resize(RenderCount() * BytesPerPixel(outputSettings.format));
+        PackPixels(outputSettings, pixelDataArr.data(), RenderCount(), outputArr.data());
+        frame.pixels = outputArr.data();
+    }
+    else {
+        ScopedTimer timer(MetricStage::readback);
+        frame.pixels = transfer.Read(output_mem_objs[outputIndex], RenderCount() * BytesPerPixel(outputSettings.format), outputArr);
+    }
+
+    if (submittedRetrace) {
+        if (submittedCosts) {
+            ScopedTimer timer(MetricStage::readback);
+            costArr.resize(RenderCount());
+            command_queue.enqueue_read_buffer(costs_mem_obj, 0, RenderCount() * sizeof(PixelCost), costArr.data());
+        }
+        else {
+            costArr.clear();
+        }
+    }
 
-inline void cpyVec3ToFloat3(cl_float3* dest, const glm::vec3& src) {
-    *dest = { src.x, src.y, src.z };
+    // Changes made after Submit() are picked up by the next frame
+    renderedVersion = submittedVersion;
+
+    frame.format = outputSettings.format;
+    return frame;
 }
-inline void cpyVec4ToFloat4(cl_float4* dest, const glm::vec4& src) {
-    *dest = { src.x, src.y, src.z, src.w };
+
+const std::vector<Frame>& OpenCLRaytracer::RenderViews(const std::vector<Camera>& views)
+{
+    viewFrames.clear();
+    if (views.empty()) return viewFrames;
+
+    if (streaming)
+        throw std::runtime_error("Multi-view rendering needs the whole scene on the device.");
+
+    size_t viewWidth = views[0].width, viewHeight = views[0].height;
+    for (const Camera& view : views) {
+        if (view.width != viewWidth || view.height != viewHeight)
+            throw std::runtime_error("Every view must have the same resolution.");
+    }
+    size_t viewPixels = viewWidth * viewHeight;
+
+    {
+        // The next frame uploads the same changes again, as only Render() marks them done
+        ScopedTimer timer(MetricStage::upload);
+        UploadChanges();
+    }
+
+    if (!hasViewsKernel)
+        CreateViewsKernel();
+    if (viewsFormat != outputSettings.format) {
+        viewsOutputKernel = outputProgram.create_kernel(packKernelName(outputSettings.format));
+        viewsFormat = outputSettings.format;
+    }
+
+    // Launches get at most a quarter of the device's memory, and no view buffer may exceed the largest allocation.
+    // Whole views per launch, a single view larger than the limit still gets one
+    size_t bytesPerPixel = BytesPerPixel(outputSettings.format);
+    cl_ulong pixelBytes = sizeof(cl_Ray) + 3 * sizeof(cl_float4) + sizeof(cl_float) + sizeof(cl_PrimaryHit) + bytesPerPixel;
+    cl_ulong largestPixelBytes = std::max<cl_ulong>(sizeof(cl_PrimaryHit), bytesPerPixel);
+    cl_ulong maxLaunchPixels = std::min<cl_ulong>(maxAllocSize / largestPixelBytes, globalMemorySize / 4 / pixelBytes);
+    size_t launchViews = std::min(std::max<size_t>((size_t)(maxLaunchPixels / std::max<size_t>(viewPixels, 1)), 1), views.size());
+    size_t launchCapacity = launchViews * viewPixels;
+    ReserveViewPixels(launchCapacity, views.size());
+
+    viewsKernel.set_arg(0, sizeof(cl_uint), &bounceLimit);
+    viewsKernel.set_arg(16, sizeof(cl_uint), &frameIndex);
+    viewsKernel.set_arg(21, sizeof(cl_uint), &lightSamples);
+    viewsKernel.set_arg(22, sizeof(cl_float4), &ambientLight);
+    viewsKernel.set_arg(23, sizeof(cl_float), &qualitySettings.rouletteThreshold);
+    // Never written, but the main kernel may have replaced the buffer since
+    viewsKernel.set_arg(28, sizeof(cl_mem), (void*)&costs_mem_obj);
+
+    cl_float invGamma = 1.f / outputSettings.gamma;
+    cl_uint toneMapping = (cl_uint)outputSettings.toneMapping;
+    viewsOutputKernel.set_arg(1, sizeof(cl_float), &outputSettings.exposure);
+    viewsOutputKernel.set_arg(2, sizeof(cl_float), &invGamma);
+    viewsOutputKernel.set_arg(3, sizeof(cl_uint), &toneMapping);
+    viewsOutputKernel.set_arg(4, sizeof(cl_mem), (void*)&viewPixelData_mem_obj);
+    viewsOutputKernel.set_arg(5, sizeof(cl_mem), (void*)&viewOutput_mem_obj);
+
+    // Both stay untouched until the queue finishes
+    viewCameraArr.assign(views.begin(), views.end());
+    viewOutputArr.resize(views.size() * viewPixels * bytesPerPixel);
+
+    cl_uint rayWidth = (cl_uint)viewWidth, rayViewHeight = (cl_uint)viewHeight;
+    viewRaysKernel.set_arg(0, sizeof(cl_uint), &rayWidth);
+    viewRaysKernel.set_arg(1, sizeof(cl_uint), &rayViewHeight);
+
+    {
+        ScopedTimer timer(MetricStage::trace);
+        command_queue.enqueue_write_buffer_async(viewCameras_mem_obj, 0, views.size() * sizeof(cl_ViewCamera), viewCameraArr.data());
+
+        for (size_t firstView = 0; firstView < views.size(); firstView += launchViews) {
+            size_t viewCount = std::min(launchViews, views.size() - firstView);
+            size_t launchPixels = viewCount * viewPixels;
+
+            cl_uint rayCount = (cl_uint)launchPixels, rayFirstView = (cl_uint)firstView;
+            viewRaysKernel.set_arg(2, sizeof(cl_uint), &rayCount);
+            viewRaysKernel.set_arg(3, sizeof(cl_uint), &rayFirstView);
+            const LaunchShape& rayShape = tuner.Tune(viewRaysKernel, command_queue, launchPixels, 1, false);
+            WorkGroupTuner::Enqueue(command_queue, viewRaysKernel, rayShape, launchPixels, 1);
+
+            // The views traced as one image, viewCount views tall
+            cl_uint imageWidth = (cl_uint)viewWidth, imageHeight = (cl_uint)(viewHeight * viewCount);
+            viewsKernel.set_arg(10, sizeof(cl_uint), &imageWidth);
+            viewsKernel.set_arg(11, sizeof(cl_uint), &imageHeight);
+            const LaunchShape& shape = tuner.Tune(viewsKernel, command_queue, imageWidth, imageHeight, true);
+            WorkGroupTuner::Enqueue(command_queue, viewsKernel, shape, imageWidth, imageHeight);
+
+            cl_uint packCount = (cl_uint)launchPixels;
+            viewsOutputKernel.set_arg(0, sizeof(cl_uint), &packCount);
+            const LaunchShape& packShape = tuner.Tune(viewsOutputKernel, command_queue, launchPixels, 1, false);
+            WorkGroupTuner::Enqueue(command_queue, viewsOutputKernel, packShape, launchPixels, 1);
+
+            command_queue.enqueue_read_buffer_async(viewOutput_mem_obj, 0, launchPixels * bytesPerPixel, &viewOutputArr[firstView * viewPixels * bytesPerPixel]);
+        }
+        command_queue.finish();
+    }
+
+    viewFrames.resize(views.size());
+    for (size_t view = 0; view < views.size(); ++view) {
+        viewFrames[view].pixels = &viewOutputArr[view * viewPixels * bytesPerPixel];
+        viewFrames[view].width = viewWidth;
+        viewFrames[view].height = viewHeight;
+        viewFrames[view].format = viewsFormat;
+    }
+    return viewFrames;
 }
-inline void cpyMat4ToFloat16(cl_float16* dest, const glm::mat4& src) {
-    const float* m = glm::value_ptr(src);
-    *dest = { m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8], m[9], m[10], m[11], m[12], m[13], m[14], m[15] };
+
+const boost::compute::buffer& OpenCLRaytracer::SharedObjects(boost::compute::event& o_uploaded)
+{
+    if (streaming)
+        throw std::runtime_error("Out-of-core scenes are never on the device as a whole and cannot be shared.");
+    if (objects.size() != OBJECT_COUNT)
+        throw std::runtime_error("Object and light counts cannot change after the raytracer is created, and rays cannot outgrow it.");
+
+    UploadObjects();
+
+    // Other queues don't follow this one's order, they wait on the marker instead
+    o_uploaded = command_queue.enqueue_marker();
+    command_queue.flush();
+    return objs_mem_obj;
 }
 
+void OpenCLRaytracer::UploadObjects()
+{
+    // Materials live inside cl_ObjectData, so either change re-uploads the objects
+    uint64_t geometryVersion = version[(size_t)SceneChange::geometry], materialsVersion = version[(size_t)SceneChange::materials];
+    if (geometryVersion == uploadedGeometryVersion && materialsVersion == uploadedMaterialsVersion) return;
+
+    transfer.Write(objs_mem_obj, (size_t)OBJECT_COUNT, objArr, [&](cl_ObjectData* dst) {
+        for (size_t i = 0; i < OBJECT_COUNT; i++) {
+            dst[i] = cl_ObjectData(objects[i]);
+        }
+    });
+
+    uploadedGeometryVersion = geometryVersion;
+    uploadedMaterialsVersion = materialsVersion;
+}
+
+void OpenCLRaytracer::UploadChanges()
+{
+    if (objects.size() != OBJECT_COUNT || lights.size() != LIGHT_COUNT || rays.size() > RAYCAST_COUNT)
+        throw std::runtime_error("Object and light counts cannot change after the raytracer is created, and rays cannot outgrow it.");
+    if (rays.size() != RenderCount())
+        throw std::runtime_error("Ray count does not match the camera's resolution.");
+
+    if (Changed(SceneChange::quality)) {
+        bounceLimit = std::min(qualitySettings.bounceLimit, MAX_BOUNCES);
+        kernel.set_arg(0, sizeof(cl_uint), &bounceLimit);
+        kernel.set_arg(23, sizeof(cl_float), &qualitySettings.rouletteThreshold);
+        if (streaming)
+            endShadingKernel.set_arg(4, sizeof(cl_float), &qualitySettings.rouletteThreshold);
+    }
+
+    // Out-of-core scenes have no objs_mem_obj, their objects are staged per chunk instead
+    if (streaming)
+        UploadChunks();
+    else
+        UploadObjects();
+
+    if (Changed(SceneChange::lights)) {
+        transfer.Write(lights_mem_obj, (size_t)LIGHT_COUNT, lightArr, [&](cl_Light* dst) {
+            for (size_t i = 0; i < LIGHT_COUNT; i++) {
+                dst[i] = cl_Light(lights[i]);
+            }
+        });
+
+        // Ambient never needs a shadow ray, so the kernel only sees the sum
+        glm::vec3 ambientSum(0.f, 0.f, 0.f);
+        for (const Light& light : lights) {
+            ambientSum += light.ambient;
+        }
+        ambientLight = { ambientSum.x, ambientSum.y, ambientSum.z, 0.f };
+
+        lightSamples = 0;
+        if (LIGHT_COUNT > lightSamplingSettings.exactLightLimit && lightSamplingSettings.samples > 0) {
+            lightSamples = lightSamplingSettings.samples;
+
+            LightTree::Build(lights, lightTree);
+            transfer.Write(lightNodes_mem_obj, lightTree.size(), lightNodeArr, [&](cl_LightNode* dst) {
+                std::copy(lightTree.begin(), lightTree.end(), dst);
+            });
+        }
+
+        kernel.set_arg(21, sizeof(cl_uint), &lightSamples);
+        kernel.set_arg(22, sizeof(cl_float4), &ambientLight);
+        if (streaming) {
+            beginShadingKernel.set_arg(16, sizeof(cl_float4), &ambientLight);
+            shadowRaysKernel.set_arg(6, sizeof(cl_uint), &lightSamples);
+        }
+    }
+
+    if (Changed(SceneChange::camera)) {
+        transfer.Write(rays_mem_obj, rays.size(), rayArr, [&](cl_Ray* dst) {
+            for (size_t i = 0; i < rays.size(); i++) {
+                dst[i] = cl_Ray(rays[i]);
+            }
+        });
+    }
+}
+
+void OpenCLRaytracer::EnqueueTrace()
+{
+    cl_uint persistentThreads = (launchMode == LaunchMode::persistentThreads) ? 1 : 0;
+    kernel.set_arg(27, sizeof(cl_uint), &persistentThreads);
+
+    cl_uint recordCostArg = recordCost ? 1 : 0;
+    if (recordCost && !hasCostBuffer) {
+        costs_mem_obj = boost::compute::buffer(context, (size_t)RAYCAST_COUNT * sizeof(PixelCost), CL_MEM_WRITE_ONLY);
+        kernel.set_arg(28, sizeof(cl_mem), (void*)&costs_mem_obj);
+        hasCostBuffer = true;
+    }
+    kernel.set_arg(29, sizeof(cl_uint), &recordCostArg);
+    submittedCosts = recordCost;
+
+    if (!persistentThreads) {
+        // Execute the OpenCL kernel on the image
+        const LaunchShape& shape = tuner.Tune(kernel, command_queue, renderWidth, renderHeight, true);
+        WorkGroupTuner::Enqueue(command_queue, kernel, shape, renderWidth, renderHeight);
+        return;
+    }
+
+    // Ordered before the launch by the queue, so Submit() doesn't wait for the previous frame
+    static const cl_uint firstPixel = 0;
+    command_queue.enqueue_fill_buffer(workCounter_mem_obj, &firstPixel, sizeof(cl_uint), 0, sizeof(cl_uint));
+
+    // Sized to the device rather than the image, the groups loop until every pixel is taken
+    size_t global_item_size = computeUnits * persistentGroupSize;
+    command_queue.enqueue_1d_range_kernel(kernel, 0, global_item_size, persistentGroupSize);
+}
+
+void OpenCLRaytracer::PrepareOutput()
+{
+    // Sized for the full resolution, so only a format change re-allocates
+    if (hasOutputKernel && frame.format == outputSettings.format) return;
+
+    // A buffer still mapped for the previous frame stays alive until that frame is given up
+    for (boost::compute::buffer& output_mem_obj : output_mem_objs) {
+        output_mem_obj = transfer.Create(context, (size_t)RAYCAST_COUNT * BytesPerPixel(outputSettings.format), CL_MEM_WRITE_ONLY);
+    }
+
+    outputKernel = outputProgram.create_kernel(packKernelName(outputSettings.format));
+
+    frame.format = outputSettings.format;
+    hasOutputKernel = true;
+}
+
+void OpenCLRaytracer::EnqueuePack()
+{
+    cl_uint count = (cl_uint)RenderCount();
+    cl_float invGamma = 1.f / outputSettings.gamma;
+    cl_uint toneMapping = (cl_uint)outputSettings.toneMapping;
+
+    outputKernel.set_arg(0, sizeof(cl_uint), &count);
+    outputKernel.set_arg(1, sizeof(cl_float), &outputSettings.exposure);
+    outputKernel.set_arg(2, sizeof(cl_float), &invGamma);
+    outputKernel.set_arg(3, sizeof(cl_uint), &toneMapping);
+    outputKernel.set_arg(4, sizeof(cl_mem), (void*)finalColor_mem_obj);
+
+    // The other buffer may still be mapped for the frame being shown
+    outputIndex ^= 1;
+    transfer.Unmap(output_mem_objs[outputIndex]);
+    outputKernel.set_arg(5, sizeof(cl_mem), (void*)&output_mem_objs[outputIndex]);
+
+    // Packing only knows the pixel count, so it stays 1-D
+    const LaunchShape& shape = tuner.Tune(outputKernel, command_queue, RenderCount(), 1, false);
+    WorkGroupTuner::Enqueue(command_queue, outputKernel, shape, RenderCount(), 1);
+}
+
+boost::compute::buffer* OpenCLRaytracer::EnqueueDenoise()
+{
+    boost::compute::buffer* src = &pixelData_mem_obj;
+    boost::compute::buffer* dst = &denoise_mem_obj;
+
+    cl_float colorPhi = denoiseSettings.colorPhi;
+
+    denoiseKernel.set_arg(4, sizeof(cl_float), &denoiseSettings.normalPhi);
+    denoiseKernel.set_arg(5, sizeof(cl_float), &denoiseSettings.depthPhi);
+    denoiseKernel.set_arg(6, sizeof(cl_float), &denoiseSettings.albedoPhi);
+
+    for (cl_uint pass = 0; pass < denoiseSettings.iterations; ++pass) {
+        cl_int stepWidth = 1 << pass;
+
+        denoiseKernel.set_arg(2, sizeof(cl_int), &stepWidth);
+        denoiseKernel.set_arg(3, sizeof(cl_float), &colorPhi);
+        denoiseKernel.set_arg(7, sizeof(cl_mem), (void*)src);
+        denoiseKernel.set_arg(11, sizeof(cl_mem), (void*)dst);
+
+        // Passes only differ in their arguments, so the first one tunes for all of them
+        const LaunchShape& shape = tuner.Tune(denoiseKernel, command_queue, renderWidth, renderHeight, true);
+        WorkGroupTuner::Enqueue(command_queue, denoiseKernel, shape, renderWidth, renderHeight);
+
+        // The raw colors are kept as temporal history, so later passes alternate between the two scratch buffers
+        src = dst;
+        dst = (dst == &denoise_mem_obj) ? &denoiseScratch_mem_obj : &denoise_mem_obj;
+        // Coarser passes average over a wider footprint, so tolerate less color variation
+        colorPhi *= 0.5f;
+    }
+
+    return src;
+}
+
+void OpenCLRaytracer::DenoiseOnHost()
+{
+    const cl_float* depth = transfer.Read(depth_mem_obj, RenderCount(), depthArr);
+    const cl_float4* normal = transfer.Read(normal_mem_obj, RenderCount(), normalArr);
+    const cl_float4* albedo = transfer.Read(albedo_mem_obj, RenderCount(), albedoArr);
+
+    CPUDenoiser::Denoise(renderWidth, renderHeight, denoiseSettings, pixelDataArr.data(), depth, normal, albedo);
+
+    // The next trace writes the guides again
+    transfer.Unmap(depth_mem_obj);
+    transfer.Unmap(normal_mem_obj);
+    transfer.Unmap(albedo_mem_obj);
+}
+
+
 OpenCLRaytracer::cl_Ray::cl_Ray() : start({ 0, 0, 0 }), direction({ 0,0,0 }) { }
 OpenCLRaytracer::cl_Ray::cl_Ray(const Ray3D& cpy) {
     cpyVec4ToFloat4(&start, cpy.start);
     cpyVec4ToFloat4(&direction, cpy.direction);
 }
 
-OpenCLRaytracer::cl_Material::cl_Material() : ambient({ 0., 0., 0. }), diffuse(ambient), specular(ambient), absorption(1), reflection(0), transparency(0), shininess(1) { }
-OpenCLRaytracer::cl_Material::cl_Material(const Material& cpy) : absorption(cpy.absorption), reflection(cpy.reflection), transparency(cpy.transparency), shininess(cpy.shininess) {
-    cpyVec3ToFloat3(&ambient, cpy.ambient);
-    cpyVec3ToFloat3(&diffuse, cpy.diffuse);
-    cpyVec3ToFloat3(&specular, cpy.specular);
-}
-
-OpenCLRaytracer::cl_ObjectData::cl_ObjectData() : mv({ 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 }), mvInverse(mv), mvInverseTranspose(mv), type(0) { }
-OpenCLRaytracer::cl_ObjectData::cl_ObjectData(const ObjectData& cpy) : mat(cpy.mat) {
-    cpyMat4ToFloat16(&mv, cpy.mv);
-    cpyMat4ToFloat16(&mvInverse, cpy.mvInverse);
-    cpyMat4ToFloat16(&mvInverseTranspose, cpy.mvInverseTranspose);
-    type = (cl_uint)cpy.type;
+OpenCLRaytracer::cl_ViewCamera::cl_ViewCamera() : axisX({ 1, 0, 0, 0 }), axisY({ 0, 1, 0, 0 }), axisZ({ 0, 0, 1, 0 }), origin({ 0, 0, 0, 1 }), projection({ 0, 0, 1, 0 }) { }
+OpenCLRaytracer::cl_ViewCamera::cl_ViewCamera(const Camera& cpy) {
+    glm::mat4 cameraToScene = cpy.CameraToScene();
+    cpyVec4ToFloat4(&axisX, cameraToScene[0]);
+    cpyVec4ToFloat4(&axisY, cameraToScene[1]);
+    cpyVec4ToFloat4(&axisZ, cameraToScene[2]);
+    cpyVec4ToFloat4(&origin, cameraToScene[3]);
+
+    // Camera::GenerateRays at the window's first pixel
+    float halfWidth = cpy.ImageWidth() / 2.0f, halfHeight = cpy.ImageHeight() / 2.0f;
+    cpyVec4ToFloat4(&projection, glm::vec4(cpy.cropX - halfWidth, ((float)cpy.ImageHeight() - cpy.cropY) - halfHeight, cpy.FocalLength(), 0.f));
 }
 
 OpenCLRaytracer::cl_Light::cl_Light() : ambient({ 0., 0., 0. }), diffuse(ambient), specular(ambient), position({ 0., 0., 0., 1. }) { }
@@ -144,3 +601,347 @@ OpenCLRaytracer::cl_Light::cl_Light(const Light& cpy) {
     cpyVec3ToFloat3(&specular, cpy.specular);
     cpyVec4ToFloat4(&position, cpy.lightPosition);
 }
+
+OpenCLRaytracer::cl_LightNode::cl_LightNode() : boundsMin({ 0., 0., 0., 0. }), boundsMax(boundsMin), links({ -1, -1, -1, -1 }) { }
+OpenCLRaytracer::cl_LightNode::cl_LightNode(const LightTreeNode& cpy) {
+    cpyVec4ToFloat4(&boundsMin, glm::vec4(cpy.boundsMin, cpy.power));
+    cpyVec4ToFloat4(&boundsMax, glm::vec4(cpy.boundsMax, 0.f));
+    links = { cpy.left, cpy.right, cpy.light, -1 };
+}
+
+void OpenCLRaytracer::SetRenderSize(size_t newWidth, size_t newHeight)
+{
+    renderWidth = newWidth;
+    renderHeight = newHeight;
+
+    cl_uint imageWidth = (cl_uint)renderWidth, imageHeight = (cl_uint)renderHeight;
+    kernel.set_arg(10, sizeof(cl_uint), &imageWidth);
+    kernel.set_arg(11, sizeof(cl_uint), &imageHeight);
+    denoiseKernel.set_arg(0, sizeof(cl_uint), &imageWidth);
+    denoiseKernel.set_arg(1, sizeof(cl_uint), &imageHeight);
+    if (streaming) {
+        beginShadingKernel.set_arg(0, sizeof(cl_uint), &imageWidth);
+        beginShadingKernel.set_arg(1, sizeof(cl_uint), &imageHeight);
+    }
+
+    frame.width = renderWidth;
+    frame.height = renderHeight;
+
+    // History pixels and cached hits no longer line up with the new image
+    hasHistory = false;
+    hasPrimaryHits = false;
+}
+
+void OpenCLRaytracer::BindFrameBuffers(bool reprojectFrame)
+{
+    kernel.set_arg(6, sizeof(cl_mem), (void*)&pixelData_mem_obj);
+    kernel.set_arg(7, sizeof(cl_mem), (void*)&depth_mem_obj);
+
+    cl_uint reprojectEnabled = reprojectFrame ? 1 : 0;
+    cl_float16 sceneToPrevCamera;
+    cpyMat4ToFloat16(&sceneToPrevCamera, tracedCamera.SceneToCamera());
+    // The image center in the previous frame's pixels, which is off center for a cropped camera
+    cl_float4 prevProjection = { tracedCamera.FocalLength(), tracedCamera.ImageWidth() / 2.0f - tracedCamera.cropX,
+        tracedCamera.ImageHeight() / 2.0f - tracedCamera.cropY, 0.f };
+    cl_uint refreshInterval = std::max(temporalSettings.refreshInterval, 1u);
+
+    kernel.set_arg(12, sizeof(cl_uint), &reprojectEnabled);
+    kernel.set_arg(13, sizeof(cl_float16), &sceneToPrevCamera);
+    kernel.set_arg(14, sizeof(cl_float4), &prevProjection);
+    kernel.set_arg(15, sizeof(cl_float), &temporalSettings.depthTolerance);
+    kernel.set_arg(16, sizeof(cl_uint), &frameIndex);
+    kernel.set_arg(17, sizeof(cl_uint), &refreshInterval);
+    kernel.set_arg(18, sizeof(cl_mem), (void*)&prevPixelData_mem_obj);
+    kernel.set_arg(19, sizeof(cl_mem), (void*)&prevDepth_mem_obj);
+
+    denoiseKernel.set_arg(8, sizeof(cl_mem), (void*)&depth_mem_obj);
+
+    if (streaming) {
+        beginShadingKernel.set_arg(4, sizeof(cl_mem), (void*)&pixelData_mem_obj);
+        beginShadingKernel.set_arg(5, sizeof(cl_mem), (void*)&depth_mem_obj);
+        beginShadingKernel.set_arg(8, sizeof(cl_uint), &reprojectEnabled);
+        beginShadingKernel.set_arg(9, sizeof(cl_float16), &sceneToPrevCamera);
+        beginShadingKernel.set_arg(10, sizeof(cl_float4), &prevProjection);
+        beginShadingKernel.set_arg(11, sizeof(cl_float), &temporalSettings.depthTolerance);
+        beginShadingKernel.set_arg(12, sizeof(cl_uint), &frameIndex);
+        beginShadingKernel.set_arg(13, sizeof(cl_uint), &refreshInterval);
+        beginShadingKernel.set_arg(14, sizeof(cl_mem), (void*)&prevPixelData_mem_obj);
+        beginShadingKernel.set_arg(15, sizeof(cl_mem), (void*)&prevDepth_mem_obj);
+        endShadingKernel.set_arg(3, sizeof(cl_mem), (void*)&pixelData_mem_obj);
+    }
+}
+
+void OpenCLRaytracer::CreateViewsKernel()
+{
+    // A second kernel object has arguments of its own, so view batches never rebind the main frame's
+    viewsKernel = program.create_kernel("shade_and_reflect");
+    viewRaysKernel = program.create_kernel("generate_view_rays");
+
+    viewsKernel.set_arg(1, sizeof(cl_uint), &OBJECT_COUNT);
+    viewsKernel.set_arg(2, sizeof(cl_mem), (void*)&objs_mem_obj);
+    viewsKernel.set_arg(3, sizeof(cl_uint), &LIGHT_COUNT);
+    viewsKernel.set_arg(4, sizeof(cl_mem), (void*)&lights_mem_obj);
+    viewsKernel.set_arg(20, sizeof(cl_mem), (void*)&lightNodes_mem_obj);
+    viewsKernel.set_arg(26, sizeof(cl_mem), (void*)&workCounter_mem_obj);
+
+    // Nothing from an earlier frame applies to the views, and they always launch one item per pixel
+    static const cl_uint disabled = 0, refreshInterval = 1;
+    static const cl_float16 sceneToPrevCamera = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+    static const cl_float4 prevProjection = { 1.f, 0.f, 0.f, 0.f };
+    viewsKernel.set_arg(12, sizeof(cl_uint), &disabled);
+    viewsKernel.set_arg(13, sizeof(cl_float16), &sceneToPrevCamera);
+    viewsKernel.set_arg(14, sizeof(cl_float4), &prevProjection);
+    viewsKernel.set_arg(15, sizeof(cl_float), &temporalSettings.depthTolerance);
+    viewsKernel.set_arg(17, sizeof(cl_uint), &refreshInterval);
+    viewsKernel.set_arg(18, sizeof(cl_mem), (void*)&prevPixelData_mem_obj);
+    viewsKernel.set_arg(19, sizeof(cl_mem), (void*)&prevDepth_mem_obj);
+    viewsKernel.set_arg(25, sizeof(cl_uint), &disabled);
+    viewsKernel.set_arg(27, sizeof(cl_uint), &disabled);
+    viewsKernel.set_arg(29, sizeof(cl_uint), &disabled);
+    // View buffers are set once a batch sizes them, see ReserveViewPixels()
+
+    viewsOutputKernel = outputProgram.create_kernel(packKernelName(outputSettings.format));
+    viewsFormat = outputSettings.format;
+    hasViewsKernel = true;
+}
+
+void OpenCLRaytracer::ReserveViewPixels(size_t pixelCount, size_t viewCount)
+{
+    if (viewCount > viewCameraCapacity) {
+        viewCameras_mem_obj = boost::compute::buffer(context, viewCount * sizeof(cl_ViewCamera), CL_MEM_READ_ONLY);
+        viewRaysKernel.set_arg(4, sizeof(cl_mem), (void*)&viewCameras_mem_obj);
+        viewCameraCapacity = viewCount;
+    }
+
+    if (pixelCount > viewPixelCapacity) {
+        viewRays_mem_obj = boost::compute::buffer(context, pixelCount * sizeof(cl_Ray), CL_MEM_READ_WRITE);
+        viewPixelData_mem_obj = boost::compute::buffer(context, pixelCount * sizeof(cl_float4), CL_MEM_READ_WRITE);
+        viewDepth_mem_obj = boost::compute::buffer(context, pixelCount * sizeof(cl_float), CL_MEM_READ_WRITE);
+        viewNormal_mem_obj = boost::compute::buffer(context, pixelCount * sizeof(cl_float4), CL_MEM_READ_WRITE);
+        viewAlbedo_mem_obj = boost::compute::buffer(context, pixelCount * sizeof(cl_float4), CL_MEM_READ_WRITE);
+        viewPrimaryHits_mem_obj = boost::compute::buffer(context, pixelCount * sizeof(cl_PrimaryHit), CL_MEM_READ_WRITE);
+
+        viewRaysKernel.set_arg(5, sizeof(cl_mem), (void*)&viewRays_mem_obj);
+        viewsKernel.set_arg(5, sizeof(cl_mem), (void*)&viewRays_mem_obj);
+        viewsKernel.set_arg(6, sizeof(cl_mem), (void*)&viewPixelData_mem_obj);
+        viewsKernel.set_arg(7, sizeof(cl_mem), (void*)&viewDepth_mem_obj);
+        viewsKernel.set_arg(8, sizeof(cl_mem), (void*)&viewNormal_mem_obj);
+        viewsKernel.set_arg(9, sizeof(cl_mem), (void*)&viewAlbedo_mem_obj);
+        viewsKernel.set_arg(24, sizeof(cl_mem), (void*)&viewPrimaryHits_mem_obj);
+        viewPixelCapacity = pixelCount;
+    }
+
+    size_t outputBytes = pixelCount * BytesPerPixel(outputSettings.format);
+    if (outputBytes > viewOutputCapacity) {
+        viewOutput_mem_obj = boost::compute::buffer(context, outputBytes, CL_MEM_WRITE_ONLY);
+        viewOutputCapacity = outputBytes;
+    }
+}
+
+void OpenCLRaytracer::CreateStreamingKernels()
+{
+    paths_mem_obj = boost::compute::buffer(context, (size_t)RAYCAST_COUNT * sizeof(cl_PathState), CL_MEM_READ_WRITE);
+    hits_mem_obj = boost::compute::buffer(context, (size_t)RAYCAST_COUNT * sizeof(cl_HitRecord), CL_MEM_READ_WRITE);
+    liveCounts_mem_obj = boost::compute::buffer(context, 2 * sizeof(cl_uint), CL_MEM_READ_WRITE);
+
+    beginPathsKernel = program.create_kernel("stream_begin_paths");
+    closestHitKernel = program.create_kernel("stream_closest_hit");
+    beginShadingKernel = program.create_kernel("stream_begin_shading");
+    shadowRaysKernel = program.create_kernel("stream_shadow_rays");
+    occlusionKernel = program.create_kernel("stream_occlusion");
+    addShadowKernel = program.create_kernel("stream_add_shadow");
+    endShadingKernel = program.create_kernel("stream_end_shading");
+
+    // Counts, bounces, chunks and light slots are set per pass, frame buffers in BindFrameBuffers() and the shadow rays in ReserveShadowSlots()
+    beginPathsKernel.set_arg(3, sizeof(cl_mem), (void*)&rays_mem_obj);
+    beginPathsKernel.set_arg(4, sizeof(cl_mem), (void*)&paths_mem_obj);
+    beginPathsKernel.set_arg(5, sizeof(cl_mem), (void*)&hits_mem_obj);
+
+    closestHitKernel.set_arg(5, sizeof(cl_mem), (void*)&paths_mem_obj);
+    closestHitKernel.set_arg(6, sizeof(cl_mem), (void*)&hits_mem_obj);
+
+    beginShadingKernel.set_arg(2, sizeof(cl_mem), (void*)&paths_mem_obj);
+    beginShadingKernel.set_arg(3, sizeof(cl_mem), (void*)&hits_mem_obj);
+    beginShadingKernel.set_arg(6, sizeof(cl_mem), (void*)&normal_mem_obj);
+    beginShadingKernel.set_arg(7, sizeof(cl_mem), (void*)&albedo_mem_obj);
+
+    shadowRaysKernel.set_arg(1, sizeof(cl_mem), (void*)&paths_mem_obj);
+    shadowRaysKernel.set_arg(2, sizeof(cl_mem), (void*)&hits_mem_obj);
+    shadowRaysKernel.set_arg(4, sizeof(cl_mem), (void*)&lights_mem_obj);
+    shadowRaysKernel.set_arg(5, sizeof(cl_mem), (void*)&lightNodes_mem_obj);
+    shadowRaysKernel.set_arg(9, sizeof(cl_mem), (void*)&liveCounts_mem_obj);
+
+    addShadowKernel.set_arg(1, sizeof(cl_mem), (void*)&paths_mem_obj);
+
+    endShadingKernel.set_arg(1, sizeof(cl_mem), (void*)&paths_mem_obj);
+    endShadingKernel.set_arg(2, sizeof(cl_mem), (void*)&hits_mem_obj);
+}
+
+size_t OpenCLRaytracer::ReserveShadowSlots(size_t slotCount)
+{
+    // Every slot holds a shadow ray per pixel, as many as fit a quarter of the device's memory share a sweep
+    cl_ulong slotBytes = (cl_ulong)RAYCAST_COUNT * sizeof(cl_ShadowRay);
+    cl_ulong budget = std::min<cl_ulong>(maxAllocSize, globalMemorySize / 4);
+    slotCount = std::min(slotCount, std::max<size_t>((size_t)(budget / slotBytes), 1));
+    if (slotCount <= shadowSlotCapacity) return slotCount;
+
+    shadows_mem_obj = boost::compute::buffer(context, slotCount * (size_t)slotBytes, CL_MEM_READ_WRITE);
+    shadowSlotCapacity = slotCount;
+
+    shadowRaysKernel.set_arg(3, sizeof(cl_mem), (void*)&shadows_mem_obj);
+    occlusionKernel.set_arg(5, sizeof(cl_mem), (void*)&shadows_mem_obj);
+    addShadowKernel.set_arg(2, sizeof(cl_mem), (void*)&shadows_mem_obj);
+    return slotCount;
+}
+
+void OpenCLRaytracer::UploadChunks()
+{
+    // Materials live inside cl_ObjectData, so either change rebuilds the chunks
+    uint64_t geometryVersion = version[(size_t)SceneChange::geometry], materialsVersion = version[(size_t)SceneChange::materials];
+    if (geometryVersion == uploadedGeometryVersion && materialsVersion == uploadedMaterialsVersion) return;
+
+    // Pending uploads still read the old objects
+    upload_queue.finish();
+
+    ScenePartition::Build(objects, chunkObjects, chunkOrder, chunks);
+
+    chunkObjArr.resize((size_t)OBJECT_COUNT);
+    for (size_t i = 0; i < chunkOrder.size(); i++) {
+        chunkObjArr[i] = cl_ObjectData(objects[chunkOrder[i]]);
+    }
+
+    residentChunk[0] = residentChunk[1] = -1;
+
+    uploadedGeometryVersion = geometryVersion;
+    uploadedMaterialsVersion = materialsVersion;
+}
+
+void OpenCLRaytracer::EnqueueStreamedTrace()
+{
+    cl_uint count = (cl_uint)RenderCount();
+
+    beginPathsKernel.set_arg(0, sizeof(cl_uint), &count);
+    shadowRaysKernel.set_arg(0, sizeof(cl_uint), &count);
+    addShadowKernel.set_arg(0, sizeof(cl_uint), &count);
+    endShadingKernel.set_arg(0, sizeof(cl_uint), &count);
+
+    beginPathsKernel.set_arg(1, sizeof(cl_uint), &bounceLimit);
+    beginPathsKernel.set_arg(2, sizeof(cl_uint), &frameIndex);
+    EnqueueStreamKernel(beginPathsKernel);
+
+    cl_uint lightSlots = (lightSamples > 0) ? lightSamples : LIGHT_COUNT;
+    cl_uint slotsPerSweep = (cl_uint)ReserveShadowSlots(lightSlots);
+
+    // The primary hit, then one step per bounce. Every sweep streams the whole scene, so the shadow rays of all light
+    // slots share one occlusion sweep, and the counts read back with them stop the trace once no path is left to shade
+    // and skip sweeps no shadow ray needs.
+    for (cl_uint step = 0; step <= bounceLimit; ++step) {
+        SweepChunks(closestHitKernel, RenderCount());
+        EnqueueStreamKernel(beginShadingKernel);
+
+        bool shading = true;
+        for (cl_uint firstSlot = 0; firstSlot < lightSlots; firstSlot += slotsPerSweep) {
+            cl_uint slotCount = std::min(slotsPerSweep, lightSlots - firstSlot);
+            ResetLiveCounts();
+            shadowRaysKernel.set_arg(7, sizeof(cl_uint), &firstSlot);
+            shadowRaysKernel.set_arg(8, sizeof(cl_uint), &slotCount);
+            EnqueueStreamKernel(shadowRaysKernel);
+
+            cl_uint liveCounts[2];
+            ReadLiveCounts(liveCounts);
+            // Every path missed or was reprojected, begin shading already wrote their pixels
+            if (liveCounts[0] == 0) {
+                shading = false;
+                break;
+            }
+            // Without live shadow rays every contribution is zero, so there is nothing to add either
+            if (liveCounts[1] == 0) continue;
+
+            SweepChunks(occlusionKernel, (size_t)slotCount * RenderCount());
+            addShadowKernel.set_arg(3, sizeof(cl_uint), &slotCount);
+            EnqueueStreamKernel(addShadowKernel);
+        }
+        if (!shading) break;
+
+        EnqueueStreamKernel(endShadingKernel);
+    }
+}
+
+void OpenCLRaytracer::ResetLiveCounts()
+{
+    static const cl_uint zero = 0;
+    command_queue.enqueue_fill_buffer(liveCounts_mem_obj, &zero, sizeof(cl_uint), 0, 2 * sizeof(cl_uint));
+}
+
+void OpenCLRaytracer::ReadLiveCounts(cl_uint o_liveCounts[2])
+{
+    command_queue.enqueue_read_buffer(liveCounts_mem_obj, 0, 2 * sizeof(cl_uint), o_liveCounts);
+}
+
+void OpenCLRaytracer::EnqueueStreamKernel(boost::compute::kernel& streamKernel)
+{
+    // Most passes update paths in place and can't be repeated for tuning, so they keep the default shape
+    WorkGroupTuner::Enqueue(command_queue, streamKernel, LaunchShape(), RenderCount(), 1);
+}
+
+void OpenCLRaytracer::SweepChunks(boost::compute::kernel& sweepKernel, size_t rayCount)
+{
+    cl_uint count = (cl_uint)rayCount;
+    sweepKernel.set_arg(4, sizeof(cl_uint), &count);
+
+    auto chunkAt = [&](size_t step) { return sweepForward ? step : chunks.size() - 1 - step; };
+
+    size_t buffer = StageChunk(chunkAt(0));
+    for (size_t step = 0; step < chunks.size(); ++step) {
+        const SceneChunk& chunk = chunks[chunkAt(step)];
+
+        cl_uint chunkSize = (cl_uint)chunk.count;
+        cl_float4 chunkMin, chunkMax;
+        cpyVec4ToFloat4(&chunkMin, glm::vec4(chunk.boundsMin, 0.f));
+        cpyVec4ToFloat4(&chunkMax, glm::vec4(chunk.boundsMax, 0.f));
+
+        sweepKernel.set_arg(0, sizeof(cl_uint), &chunkSize);
+        sweepKernel.set_arg(1, sizeof(cl_mem), (void*)&chunk_mem_objs[buffer]);
+        sweepKernel.set_arg(2, sizeof(cl_float4), &chunkMin);
+        sweepKernel.set_arg(3, sizeof(cl_float4), &chunkMax);
+
+        // Sweeps only lower hit times or block shadow rays, so they can be repeated for tuning
+        boost::compute::wait_list uploaded(chunkUploaded[buffer]);
+        const LaunchShape& shape = tuner.Tune(sweepKernel, command_queue, rayCount, 1, false, uploaded);
+        chunkReleased[buffer] = WorkGroupTuner::Enqueue(command_queue, sweepKernel, shape, rayCount, 1, uploaded);
+
+        // The next chunk uploads while this one is traced
+        if (step + 1 < chunks.size())
+            buffer = StageChunk(chunkAt(step + 1));
+    }
+
+    sweepForward = !sweepForward;
+}
+
+size_t OpenCLRaytracer::StageChunk(size_t chunkIndex)
+{
+    for (size_t buffer = 0; buffer < 2; ++buffer) {
+        if (residentChunk[buffer] == (long long)chunkIndex) {
+            lastChunkBuffer = buffer;
+            return buffer;
+        }
+    }
+
+    // The other buffer holds the chunk being traced
+    size_t buffer = 1 - lastChunkBuffer;
+
+    boost::compute::wait_list released;
+    if (chunkReleased[buffer].get()) {
+        released.insert(chunkReleased[buffer]);
+        // The upload queue can only see the trace finish once it has been sent to the device
+        command_queue.flush();
+    }
+
+    const SceneChunk& chunk = chunks[chunkIndex];
+    chunkUploaded[buffer] = upload_queue.enqueue_write_buffer_async(chunk_mem_objs[buffer], 0, chunk.count * sizeof(cl_ObjectData), chunkObjArr.data() + chunk.first, released);
+    upload_queue.flush();
+
+    residentChunk[buffer] = (long long)chunkIndex;
+    lastChunkBuffer = buffer;
+    return buffer;
+}
@@ -1,6 +1,7 @@
 #ifndef __RAYCAST_TASK__
 #define __RAYCAST_TASK__
 
+#include <chrono>
 #include <vector>
 
 #ifdef __APPLE__
@@ -11,6 +12,12 @@
 
 #include "IRaytracer.hpp"
 #include "ObjectData.hpp"
+#include "LightTree.hpp"
+#include "WorkGroupTuner.hpp"
+#include "BufferTransfer.hpp"
+#include "ScenePartition.hpp"
+#include "CostHeatmap.hpp"
+#include "CLSceneTypes.hpp"
 
 #include <boost/compute/system.hpp>
 #include <boost/compute/buffer.hpp>
@@ -18,9 +25,18 @@
 #include <boost/compute/command_queue.hpp>
 #include <boost/compute/program.hpp>
 #include <boost/compute/kernel.hpp>
+#include <boost/compute/event.hpp>
 
 #define MAX_SOURCE_SIZE (0x100000)
 
+enum class LaunchMode {
+    // One work item per pixel
+    perPixel,
+    // About one work-group per compute unit, each pulling batches of pixels from a global counter until the image is done.
+    // Balances scenes where a few pixels bounce far more often than the rest.
+    persistentThreads
+};
+
 class OpenCLRaytracer : IRaytracer {
     struct cl_Ray {
         cl_float4 start, direction;
@@ -29,24 +45,13 @@ class OpenCLRaytracer : IRaytracer {
         cl_Ray(const Ray3D& cpy);
     };
 
-    struct cl_Material {
-        cl_float3 ambient, diffuse, specular;
-        cl_float absorption, reflection, transparency;
-        cl_float shininess;
+    // Must match ViewCamera in shade_and_reflect_kernel.cl
+    struct cl_ViewCamera {
+        cl_float4 axisX, axisY, axisZ, origin;
+        cl_float4 projection;
 
-        cl_Material();
-        cl_Material(const Material& cpy);
-    };
-
-    struct cl_ObjectData {
-        cl_Material mat;
-        cl_float16 mv, mvInverse, mvInverseTranspose;
-        cl_uint type;
-        // Necessary for alignment on vram (for my drivers)
-        uint8_t spacer[60];
-
-        cl_ObjectData();
-        cl_ObjectData(const ObjectData& cpy);
+        cl_ViewCamera();
+        cl_ViewCamera(const Camera& cpy);
     };
 
     struct cl_Light {
@@ -57,31 +62,252 @@ class OpenCLRaytracer : IRaytracer {
         cl_Light(const Light& cpy);
     };
 
+    // Must match LightNode in shade_and_reflect_kernel.cl
+    struct cl_LightNode {
+        // w of boundsMin holds the node's power
+        cl_float4 boundsMin, boundsMax;
+        // Left child, right child and light index
+        cl_int4 links;
+
+        cl_LightNode();
+        cl_LightNode(const LightTreeNode& cpy);
+    };
+
+    // Device-only cache of the primary hits, only its size is needed on the host.
+    // Must match PrimaryHit in shade_and_reflect_kernel.cl
+    struct cl_PrimaryHit {
+        cl_float4 intersection, normal, reflection;
+        cl_float time;
+        cl_int object;
+        cl_int spacer[2];
+    };
+
+    // Device-only state of the out-of-core passes, only sizes are needed on the host.
+    // Must match HitRecord, PathState and ShadowRay in shade_and_reflect_kernel.cl
+    struct cl_HitRecord {
+        cl_Material mat;
+        cl_float4 intersection;
+        cl_float3 normal, reflection;
+        cl_float time;
+        cl_int object;
+    };
+
+    struct cl_PathState {
+        cl_Ray ray;
+        cl_float4 color, shade, lastReflection;
+        cl_float absorption, pathWeight;
+        cl_uint rngState, bounces;
+        cl_uint active, depth;
+        cl_uint spacer[2];
+    };
+
+    struct cl_ShadowRay {
+        cl_Ray ray;
+        cl_float4 contribution;
+    };
+
 public:
-    OpenCLRaytracer(const std::vector<ObjectData>& objects, const std::vector<Light>& lights, const std::vector<Ray3D>& rays, const unsigned int MAX_BOUNCES);
+    // Scenes too large for the device, or split by streamingSettings, are traced chunk by chunk
+    OpenCLRaytracer(const std::vector<ObjectData>& objects, const std::vector<Light>& lights, const std::vector<Ray3D>& rays, size_t width, size_t height, const unsigned int MAX_BOUNCES,
+        const StreamingSettings& streamingSettings = StreamingSettings());
     ~OpenCLRaytracer();
 
     // Inherited via IRaytracer
-    virtual cl_float4* Render() override;
+    virtual void Submit() override;
+    virtual const Frame& Render() override;
+
+    // Milliseconds from the last rendered frame's trace being queued to its pixels being ready, covering the trace,
+    // device denoise and pack but not the host waiting to collect it. 0 when the frame was only re-packed.
+    float LastTraceTime() const { return lastTraceTime; }
+
+    // Takes effect from the next trace, out-of-core tracing always runs its passes per pixel
+    void SetLaunchMode(LaunchMode mode) { launchMode = mode; }
+
+    // Records the work every pixel took from the next trace on, out-of-core tracing records nothing.
+    // Primary hits are traced again on every frame while recording instead of being re-shaded from the cache.
+    void SetCostRecording(bool enabled) { recordCost = enabled; }
+    // Costs of the last frame traced while recording, one per pixel of the render size in row-major order
+    const std::vector<PixelCost>& PixelCosts() const { return costArr; }
+
+    // Renders the loaded scene from every camera, tracing the views stacked into one image in launches sized to
+    // fit a quarter of the device's memory. Only the cameras are uploaded, the device generates their rays. Scene buffers and the program are shared with the main frame, which is left untouched.
+    // Cameras must share a resolution. Views use the current quality, light and output settings but are never
+    // denoised or reprojected. The frames stay valid until the next call.
+    const std::vector<Frame>& RenderViews(const std::vector<Camera>& views);
+
+    // The device copy of the objects for kernels on the default context, such as an OpenCLRayQuery over this scene.
+    // Pending geometry and material changes are uploaded first, o_uploaded completes once they are on the device.
+    // Throws for out-of-core scenes.
+    const boost::compute::buffer& SharedObjects(boost::compute::event& o_uploaded);
 
 private:
+    void UploadChanges();
+    // Objects are shared outside of frames, so they keep their own record of what is on the device
+    void UploadObjects();
+    // Resolution actually traced, at most the one the raytracer was created with
+    void SetRenderSize(size_t newWidth, size_t newHeight);
+    size_t RenderCount() const { return renderWidth * renderHeight; }
+    void BindFrameBuffers(bool reprojectFrame);
+    // Returns the buffer holding the filtered colors
+    boost::compute::buffer* EnqueueDenoise();
+    void DenoiseOnHost();
+    void PrepareOutput();
+    void EnqueuePack();
+    void EnqueueTrace();
+
+    // Multi-view rendering
+    void CreateViewsKernel();
+    // Grows the view buffers to hold pixelCount pixels of the current output format and viewCount cameras
+    void ReserveViewPixels(size_t pixelCount, size_t viewCount);
+
+    // Out-of-core tracing
+    void CreateStreamingKernels();
+    // Rebuilds the chunks when the objects changed since they were last built
+    void UploadChunks();
+    void EnqueueStreamedTrace();
+    void EnqueueStreamKernel(boost::compute::kernel& streamKernel);
+    // Runs sweepKernel over rayCount rays against every chunk, its first five arguments are the chunk and the ray count
+    void SweepChunks(boost::compute::kernel& sweepKernel, size_t rayCount);
+    // Starts uploading the chunk unless it is still on the device, returns the chunk buffer holding it
+    size_t StageChunk(size_t chunkIndex);
+    // Grows the shadow rays to hold slotCount light slots per pixel where memory allows, returns the slots one sweep can take
+    size_t ReserveShadowSlots(size_t slotCount);
+    // Zeroes the live counts before the shadow rays increment them
+    void ResetLiveCounts();
+    // Waits for the passes queued so far and reads both counts
+    void ReadLiveCounts(cl_uint o_liveCounts[2]);
+
     const cl_uint MAX_BOUNCES;
     const cl_uint OBJECT_COUNT, LIGHT_COUNT, RAYCAST_COUNT;
+    size_t renderWidth = 0, renderHeight = 0;
 
+    LaunchMode launchMode = LaunchMode::perPixel;
+    cl_uint computeUnits = 1;
+    // Device limits the view launches are sized from
+    cl_ulong maxAllocSize = 0, globalMemorySize = 0;
+    size_t persistentGroupSize = 64;
+    // Next pixel for the persistent threads to take, reset every trace
+    boost::compute::buffer workCounter_mem_obj;
+    bool recordCost = false;
+    // Allocated the first time costs are recorded
+    boost::compute::buffer costs_mem_obj;
+    bool hasCostBuffer = false;
+    // Whether the submitted trace wrote costs_mem_obj
+    bool submittedCosts = false;
+    std::vector<PixelCost> costArr;
+    // Kept from the last quality and light changes for the out-of-core passes and view batches
+    cl_uint bounceLimit = 0, lightSamples = 0;
+    cl_float4 ambientLight = { 0.f, 0.f, 0.f, 0.f };
+
+    uint64_t uploadedGeometryVersion = 0, uploadedMaterialsVersion = 0;
+
+    // Staging for devices without zero-copy buffers, see BufferTransfer
     std::vector<cl_ObjectData> objArr;
     std::vector<cl_Light> lightArr;
+    std::vector<cl_LightNode> lightNodeArr;
     std::vector<cl_Ray> rayArr;
-    cl_float4* pixelDataArr = NULL;
+    std::vector<cl_float> depthArr;
+    std::vector<cl_float4> normalArr, albedoArr;
+
+    std::vector<LightTreeNode> lightTree;
+    // Colors filtered in place by the host denoiser
+    std::vector<cl_float4> pixelDataArr;
+
+    // Packed pixels in outputSettings.format when packed on the host or read back from the device
+    std::vector<cl_uchar> outputArr;
+    Frame frame;
 
     boost::compute::buffer objs_mem_obj;
     boost::compute::buffer lights_mem_obj;
+    boost::compute::buffer lightNodes_mem_obj;
     boost::compute::buffer rays_mem_obj;
     boost::compute::buffer pixelData_mem_obj;
+    boost::compute::buffer depth_mem_obj;
+    boost::compute::buffer normal_mem_obj;
+    boost::compute::buffer albedo_mem_obj;
+    // Ping-pong targets for the denoise passes, pixelData_mem_obj is never overwritten
+    boost::compute::buffer denoise_mem_obj;
+    boost::compute::buffer denoiseScratch_mem_obj;
+    // Colors ready to pack, either pixelData_mem_obj or a denoise target
+    boost::compute::buffer* finalColor_mem_obj = &pixelData_mem_obj;
+
+    // Previous frame's raw colors and primary hit distances, swapped with the current ones every trace
+    boost::compute::buffer prevPixelData_mem_obj;
+    boost::compute::buffer prevDepth_mem_obj;
+    Camera tracedCamera;
+    bool hasHistory = false;
+
+    // Primary hits of the last trace, valid until the geometry, camera or render size change
+    boost::compute::buffer primaryHits_mem_obj;
+    bool hasPrimaryHits = false;
+    cl_uint frameIndex = 0;
+
+    // Objects are streamed through two chunk buffers, one uploading while the other is traced
+    bool streaming = false;
+    size_t chunkObjects = 0;
+    std::vector<SceneChunk> chunks;
+    std::vector<size_t> chunkOrder;
+    // Every object in chunk order, the source of the chunk uploads
+    std::vector<cl_ObjectData> chunkObjArr;
+    boost::compute::buffer chunk_mem_objs[2];
+    // Chunk held by each buffer, -1 when empty
+    long long residentChunk[2] = { -1, -1 };
+    boost::compute::event chunkUploaded[2], chunkReleased[2];
+    size_t lastChunkBuffer = 0;
+    // Sweeps alternate direction so each starts on the chunks the previous one left on the device
+    bool sweepForward = true;
+    boost::compute::buffer paths_mem_obj;
+    boost::compute::buffer hits_mem_obj;
+    // Slot-major, [slot][pixel], allocated for the light slots of the first streamed trace that needs them
+    boost::compute::buffer shadows_mem_obj;
+    size_t shadowSlotCapacity = 0;
+    // Paths being shaded, then shadow rays left to sweep, so passes stop once nothing is left to trace
+    boost::compute::buffer liveCounts_mem_obj;
+
+    // View batches trace into buffers of their own, allocated by the first RenderViews()
+    bool hasViewsKernel = false;
+    size_t viewPixelCapacity = 0, viewOutputCapacity = 0, viewCameraCapacity = 0;
+    PixelFormat viewsFormat = PixelFormat::rgba8;
+    std::vector<cl_ViewCamera> viewCameraArr;
+    std::vector<cl_uchar> viewOutputArr;
+    std::vector<Frame> viewFrames;
+    boost::compute::buffer viewCameras_mem_obj;
+    // Generated on the device for each launch
+    boost::compute::buffer viewRays_mem_obj;
+    boost::compute::buffer viewPixelData_mem_obj;
+    boost::compute::buffer viewDepth_mem_obj;
+    boost::compute::buffer viewNormal_mem_obj;
+    boost::compute::buffer viewAlbedo_mem_obj;
+    boost::compute::buffer viewPrimaryHits_mem_obj;
+    boost::compute::buffer viewOutput_mem_obj;
+
+    // Set by Submit() until Render() collects the frame
+    bool submitted = false;
+    bool submittedRetrace = false;
+    std::chrono::steady_clock::time_point traceStart;
+    float lastTraceTime = 0.f;
+    std::array<uint64_t, (size_t)SceneChange::count> submittedVersion;
+    // Tone-mapped pixels sized to the output format. Packing alternates between the two so
+    // a mapped frame stays readable while the next one is submitted.
+    boost::compute::buffer output_mem_objs[2];
+    size_t outputIndex = 0;
+    bool hasOutputKernel = false;
 
     boost::compute::context context;
     boost::compute::command_queue command_queue;
+    boost::compute::command_queue upload_queue;
+    WorkGroupTuner tuner;
+    BufferTransfer transfer;
     boost::compute::program program;
     boost::compute::kernel kernel;
+    boost::compute::program denoiseProgram;
+    boost::compute::kernel denoiseKernel;
+    boost::compute::program outputProgram;
+    boost::compute::kernel outputKernel;
+    boost::compute::kernel viewsKernel;
+    boost::compute::kernel viewRaysKernel;
+    boost::compute::kernel viewsOutputKernel;
+    boost::compute::kernel beginPathsKernel, closestHitKernel, beginShadingKernel, shadowRaysKernel, occlusionKernel, addShadowKernel, endShadingKernel;
 };
 
 #endif
\ No newline at end of file
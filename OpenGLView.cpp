@@ -1,17 +1,41 @@
 #include "OpenGLView.hpp"
 #include <stdexcept>
 
+// Not exposed by the GL 1.1 headers on Windows
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT 0x140B
+#endif
+#ifndef GL_UNSIGNED_INT_2_10_10_10_REV
+#define GL_UNSIGNED_INT_2_10_10_10_REV 0x8368
+#endif
+
+inline GLenum pixelType(PixelFormat format) {
+    switch (format) {
+    case PixelFormat::rgba32f:
+        return GL_FLOAT;
+    case PixelFormat::rgba16f:
+        return GL_HALF_FLOAT;
+    case PixelFormat::rgb10a2:
+        return GL_UNSIGNED_INT_2_10_10_10_REV;
+    case PixelFormat::rgba8:
+    default:
+        return GL_UNSIGNED_BYTE;
+    }
+}
+
 OpenGLView::OpenGLView()
 {
 }
 
-void OpenGLView::Display(const cl_float4* pixelData)
+void OpenGLView::Display(const Frame& frame)
 {
     glfwPollEvents();
 
     glClear(GL_COLOR_BUFFER_BIT);
 
-    glDrawPixels(width, height, GL_RGBA, GL_FLOAT, pixelData);
+    // Frames rendered below the window resolution are stretched to fill it
+    glPixelZoom((float)width / frame.width, -(float)height / frame.height);
+    glDrawPixels(frame.width, frame.height, GL_RGBA, pixelType(frame.format), frame.pixels);
 
     glfwSwapBuffers(window);
 }
@@ -34,6 +58,10 @@ void OpenGLView::SetUpWindow(size_t width, size_t height)
 
     glfwMakeContextCurrent(window);
 
+    glfwSetWindowUserPointer(window, this);
+    glfwSetWindowRefreshCallback(window, OnRefresh);
+    glfwSetKeyCallback(window, OnKey);
+
     glViewport(0, 0, width, height);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
@@ -51,3 +79,39 @@ bool OpenGLView::ShouldWindowClose()
 {
     return glfwWindowShouldClose(window);
 }
+
+void OpenGLView::WaitEvents(double timeout)
+{
+    glfwWaitEventsTimeout(timeout);
+}
+
+bool OpenGLView::ConsumeRefresh()
+{
+    bool refresh = needsRefresh;
+    needsRefresh = false;
+    return refresh;
+}
+
+bool OpenGLView::ConsumeKeyPress(int key)
+{
+    return pressedKeys.erase(key) > 0;
+}
+
+bool OpenGLView::IsKeyDown(int key)
+{
+    return glfwGetKey(window, key) == GLFW_PRESS;
+}
+
+void OpenGLView::OnRefresh(GLFWwindow* window)
+{
+    OpenGLView* view = (OpenGLView*)glfwGetWindowUserPointer(window);
+    view->needsRefresh = true;
+}
+
+void OpenGLView::OnKey(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS) return;
+
+    OpenGLView* view = (OpenGLView*)glfwGetWindowUserPointer(window);
+    view->pressedKeys.insert(key);
+}
@@ -1,26 +1,41 @@
 #pragma once
 
+#include <set>
 #include <vector>
 #include <GLFW/glfw3.h>
 
-#include <CL/cl.h>
+#include "Frame.hpp"
 
 class OpenGLView
 {
 public:
     OpenGLView();
 
-    void Display(const cl_float4* pixelData);
+    void Display(const Frame& frame);
 
     void SetUpWindow(size_t width, size_t height);
     void TearDownWindow();
 
     bool ShouldWindowClose();
 
+    // Blocks until input arrives, the window needs attention or timeout seconds have passed
+    void WaitEvents(double timeout);
+    // True once after the window contents were damaged and the last frame must be redrawn
+    bool ConsumeRefresh();
+    // True once per press of key since the last call
+    bool ConsumeKeyPress(int key);
+    bool IsKeyDown(int key);
+
 private:
+    static void OnRefresh(GLFWwindow* window);
+    static void OnKey(GLFWwindow* window, int key, int scancode, int action, int mods);
+
     size_t width, height;
     GLFWwindow* window = NULL;
 
+    bool needsRefresh = false;
+    std::set<int> pressedKeys;
+
     GLuint image;
 };
 
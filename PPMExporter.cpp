@@ -4,7 +4,7 @@
 #include <fstream>
 #include <iostream>
 
-void PPMExporter::ExportP3(const std::string& outFileLoc, size_t width, size_t height, const std::vector<float>& pixelData)
+void PPMExporter::ExportP3(const std::string& outFileLoc, const Frame& frame)
 {
     std::cout << "Exporting to file '" << outFileLoc << "'...\n";
 
@@ -13,12 +13,14 @@ void PPMExporter::ExportP3(const std::string& outFileLoc, size_t width, size_t h
     std::ofstream op(outFileLoc);
 
     op << "P3" << "\n";
-    op << width << " " << height << "\n";
+    op << frame.width << " " << frame.height << "\n";
     op << "255\n";
-    for (size_t ii = 0; ii < height * width; ++ii) {
-        op << std::min(255, (int)floorf(pixelData[ii * 3] * 255.f)) << " ";
-        op << std::min(255, (int)floorf(pixelData[ii * 3 + 1] * 255.f)) << " ";
-        op << std::min(255, (int)floorf(pixelData[ii * 3 + 2] * 255.f)) << std::endl;
+    uint8_t rgb[3];
+    for (size_t ii = 0; ii < frame.height * frame.width; ++ii) {
+        UnpackRGB8(frame, ii, rgb);
+        op << (int)rgb[0] << " ";
+        op << (int)rgb[1] << " ";
+        op << (int)rgb[2] << "\n";
     }
     op.close();
 
@@ -1,10 +1,10 @@
 #pragma once
 #include <string>
-#include <vector>
+#include "Frame.hpp"
 
 class PPMExporter
 {
 public:
-    static void ExportP3(const std::string& outFileLoc, size_t width, size_t height, const std::vector<float>& pixelData);
+    static void ExportP3(const std::string& outFileLoc, const Frame& frame);
 };
 
@@ -0,0 +1,392 @@
+#include "RenderFarm.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "IRaytracer.hpp"
+#include "Metrics.hpp"
+#include "OpenCLRaytracer.hpp"
+
+using namespace std;
+
+namespace {
+    class ByteWriter {
+    public:
+        template<typename T>
+        void Write(const T& value) {
+            const uint8_t* bytes = (const uint8_t*)&value;
+            data.insert(data.end(), bytes, bytes + sizeof(T));
+        }
+
+        std::vector<uint8_t> data;
+    };
+
+    class ByteReader {
+    public:
+        explicit ByteReader(const std::vector<uint8_t>& data) : data(data) { }
+
+        template<typename T>
+        T Read() {
+            T value;
+            ReadBytes(&value, sizeof(T));
+            return value;
+        }
+
+        void ReadBytes(void* o_value, size_t size) {
+            if (offset + size > data.size())
+                throw std::runtime_error("Render farm message is truncated.");
+            memcpy(o_value, data.data() + offset, size);
+            offset += size;
+        }
+
+        size_t Remaining() const { return data.size() - offset; }
+
+    private:
+        const std::vector<uint8_t>& data;
+        size_t offset = 0;
+    };
+}
+
+bool SendFarmMessage(Socket& socket, FarmMessage type, const std::vector<uint8_t>& payload)
+{
+    FarmMessageHeader header = { type, (uint32_t)payload.size() };
+    return socket.SendAll(&header, sizeof(header)) && (payload.empty() || socket.SendAll(payload.data(), payload.size()));
+}
+
+bool ReceiveFarmMessage(Socket& socket, FarmMessage& o_type, std::vector<uint8_t>& o_payload)
+{
+    FarmMessageHeader header;
+    if (!socket.ReceiveAll(&header, sizeof(header))) return false;
+
+    o_type = header.type;
+    o_payload.resize(header.size);
+    return header.size == 0 || socket.ReceiveAll(o_payload.data(), o_payload.size());
+}
+
+RenderCoordinator::RenderCoordinator(const std::vector<ObjectData>& objects, const std::vector<Light>& lights, size_t width, size_t height, float fov, unsigned int maxBounces,
+    const FarmRenderSettings& renderSettings, const FarmSettings& settings)
+    : width(width), height(height), format(renderSettings.output.format), settings(settings)
+{
+    // The scene is serialized once and sent as-is to every worker that joins
+    ByteWriter scene;
+    scene.Write((uint32_t)width);
+    scene.Write((uint32_t)height);
+    scene.Write(fov);
+    scene.Write((uint32_t)maxBounces);
+    scene.Write(settings.tileSize);
+    scene.Write(renderSettings.output);
+    scene.Write(renderSettings.denoise);
+    scene.Write(renderSettings.temporal);
+    scene.Write(renderSettings.lightSampling);
+    scene.Write(renderSettings.quality);
+
+    scene.Write((uint32_t)objects.size());
+    for (const ObjectData& obj : objects) {
+        scene.Write(obj.type);
+        scene.Write(obj.mat);
+        scene.Write(obj.mv);
+    }
+
+    scene.Write((uint32_t)lights.size());
+    for (const Light& light : lights) {
+        scene.Write((const LightProperties&)light);
+        scene.Write(light.lightPosition);
+    }
+    scenePayload = std::move(scene.data);
+
+    listener = Socket::Listen(settings.port);
+}
+
+RenderCoordinator::~RenderCoordinator()
+{
+    for (Worker& worker : workers) {
+        SendFarmMessage(worker.socket, FarmMessage::shutdown, std::vector<uint8_t>());
+    }
+}
+
+void RenderCoordinator::RenderFrame(const Camera& camera, std::vector<uint8_t>& o_pixels, Frame& o_frame)
+{
+    RenderFrames(std::vector<Camera>(1, camera), [&](size_t, const Frame& frame) {
+        const uint8_t* pixels = (const uint8_t*)frame.pixels;
+        o_pixels.assign(pixels, pixels + width * height * BytesPerPixel(format));
+
+        o_frame = frame;
+        o_frame.pixels = o_pixels.data();
+    });
+}
+
+void RenderCoordinator::RenderFrames(const std::vector<Camera>& cameras, const FrameCallback& onFrame)
+{
+    const size_t bytesPerPixel = BytesPerPixel(format);
+    const uint32_t tileSize = settings.tileSize;
+
+    jobs.clear();
+    for (size_t frameIndex = 0; frameIndex < cameras.size(); ++frameIndex) {
+        for (uint32_t y = 0; y < height; y += tileSize) {
+            for (uint32_t x = 0; x < width; x += tileSize) {
+                Job job;
+                job.frame = frameIndex;
+                job.x = x;
+                job.y = y;
+                job.width = std::min<uint32_t>(tileSize, (uint32_t)width - x);
+                job.height = std::min<uint32_t>(tileSize, (uint32_t)height - y);
+                jobs.push_back(job);
+            }
+        }
+    }
+
+    std::deque<size_t> pending;
+    for (size_t ii = 0; ii < jobs.size(); ++ii) {
+        pending.push_back(ii);
+    }
+
+    // Frames are only allocated while they have tiles in flight
+    std::vector<std::vector<uint8_t>> framePixels(cameras.size());
+    std::vector<size_t> tilesLeft(cameras.size(), jobs.size() / std::max<size_t>(cameras.size(), 1));
+
+    size_t jobsLeft = jobs.size();
+    std::vector<uint8_t> payload;
+
+    if (workers.empty())
+        std::cout << "Waiting for render farm workers on port " << settings.port << "...\n";
+
+    while (jobsLeft > 0) {
+        Metrics::ReportIfRequested(std::cout);
+
+        // Hand out work to idle workers, duplicating stuck jobs once the queue runs dry
+        for (Worker& worker : workers) {
+            if (worker.job >= 0 || !worker.socket.IsOpen()) continue;
+
+            int64_t next = -1;
+            while (next < 0 && !pending.empty()) {
+                if (!jobs[pending.front()].done) next = (int64_t)pending.front();
+                pending.pop_front();
+            }
+            if (next < 0) next = FindSlowJob((size_t)(&worker - workers.data()));
+            if (next < 0) break;
+
+            if (!Dispatch(worker, (size_t)next, cameras))
+                DropWorker(worker, pending);
+        }
+
+        workers.erase(std::remove_if(workers.begin(), workers.end(), [](const Worker& worker) { return !worker.socket.IsOpen(); }), workers.end());
+
+        std::vector<Socket*> sockets(1, &listener);
+        for (Worker& worker : workers) {
+            sockets.push_back(&worker.socket);
+        }
+
+        // Wakes up periodically to check for stuck jobs
+        for (size_t ready : Socket::WaitReadable(sockets, 100)) {
+            if (ready == 0) {
+                AcceptWorker();
+                continue;
+            }
+
+            Worker& worker = workers[ready - 1];
+            FarmMessage type;
+            if (!ReceiveFarmMessage(worker.socket, type, payload) || type != FarmMessage::result || worker.job < 0
+                || payload.size() < sizeof(uint64_t)) {
+                DropWorker(worker, pending);
+                continue;
+            }
+
+            ByteReader reader(payload);
+            uint64_t jobIndex = reader.Read<uint64_t>();
+            if (jobIndex != (uint64_t)worker.job) {
+                DropWorker(worker, pending);
+                continue;
+            }
+
+            Job& job = jobs[(size_t)jobIndex];
+            size_t rowBytes = job.width * bytesPerPixel;
+            if (reader.Remaining() != rowBytes * job.height) {
+                DropWorker(worker, pending);
+                continue;
+            }
+
+            double jobTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - worker.dispatchTime).count();
+            averageJobTime += (jobTime - averageJobTime) / (double)std::min<size_t>(++finishedJobs, 32);
+            worker.job = -1;
+
+            // A duplicate of a job that already came back
+            if (job.done) continue;
+
+            std::vector<uint8_t>& pixels = framePixels[job.frame];
+            if (pixels.empty()) pixels.resize(width * height * bytesPerPixel);
+
+            for (uint32_t row = 0; row < job.height; ++row) {
+                reader.ReadBytes(pixels.data() + ((job.y + row) * width + job.x) * bytesPerPixel, rowBytes);
+            }
+
+            job.done = true;
+            --jobsLeft;
+
+            if (--tilesLeft[job.frame] == 0) {
+                Frame frame;
+                frame.pixels = pixels.data();
+                frame.width = width;
+                frame.height = height;
+                frame.format = format;
+                onFrame(job.frame, frame);
+
+                std::vector<uint8_t>().swap(pixels);
+            }
+        }
+    }
+}
+
+void RenderCoordinator::AcceptWorker()
+{
+    Worker worker;
+    worker.socket = listener.Accept();
+
+    if (SendFarmMessage(worker.socket, FarmMessage::scene, scenePayload))
+        workers.push_back(std::move(worker));
+}
+
+void RenderCoordinator::DropWorker(Worker& worker, std::deque<size_t>& pending)
+{
+    // Whatever it was working on goes back to the front of the queue
+    if (worker.job >= 0 && !jobs[(size_t)worker.job].done)
+        pending.push_front((size_t)worker.job);
+
+    worker.job = -1;
+    worker.socket.Close();
+}
+
+bool RenderCoordinator::Dispatch(Worker& worker, size_t jobIndex, const std::vector<Camera>& cameras)
+{
+    Job& job = jobs[jobIndex];
+    const Camera& camera = cameras[job.frame];
+
+    ByteWriter message;
+    message.Write((uint64_t)jobIndex);
+    message.Write(camera.position);
+    message.Write(camera.yaw);
+    message.Write(camera.pitch);
+    message.Write(job.x);
+    message.Write(job.y);
+    message.Write(job.width);
+    message.Write(job.height);
+
+    worker.job = (int64_t)jobIndex;
+    worker.dispatchTime = job.dispatchTime = std::chrono::steady_clock::now();
+    return SendFarmMessage(worker.socket, FarmMessage::job, message.data);
+}
+
+int64_t RenderCoordinator::FindSlowJob(size_t idleWorker) const
+{
+    double timeout = std::max(settings.minJobTimeout, settings.slowJobFactor * averageJobTime);
+    auto now = std::chrono::steady_clock::now();
+
+    int64_t slowest = -1;
+    double slowestTime = timeout;
+    for (size_t ii = 0; ii < workers.size(); ++ii) {
+        if (ii == idleWorker || workers[ii].job < 0) continue;
+
+        const Job& job = jobs[(size_t)workers[ii].job];
+        double outTime = std::chrono::duration<double>(now - job.dispatchTime).count();
+        if (!job.done && outTime > slowestTime) {
+            slowest = workers[ii].job;
+            slowestTime = outTime;
+        }
+    }
+    return slowest;
+}
+
+RenderWorker::RenderWorker(const std::string& host, uint16_t port)
+{
+    connection = Socket::Connect(host, port);
+}
+
+void RenderWorker::Run()
+{
+    FarmMessage type;
+    std::vector<uint8_t> payload;
+
+    if (!ReceiveFarmMessage(connection, type, payload) || type != FarmMessage::scene)
+        throw std::runtime_error("Expected a scene from the render farm coordinator.");
+
+    ByteReader scene(payload);
+    uint32_t width = scene.Read<uint32_t>();
+    uint32_t height = scene.Read<uint32_t>();
+    float fov = scene.Read<float>();
+    uint32_t maxBounces = scene.Read<uint32_t>();
+    uint32_t tileSize = scene.Read<uint32_t>();
+    FarmRenderSettings renderSettings;
+    renderSettings.output = scene.Read<OutputSettings>();
+    renderSettings.denoise = scene.Read<DenoiseSettings>();
+    renderSettings.temporal = scene.Read<TemporalSettings>();
+    renderSettings.lightSampling = scene.Read<LightSamplingSettings>();
+    renderSettings.quality = scene.Read<QualitySettings>();
+
+    std::vector<ObjectData> objects;
+    uint32_t objectCount = scene.Read<uint32_t>();
+    for (uint32_t ii = 0; ii < objectCount; ++ii) {
+        ObjectData::PrimativeType objType = scene.Read<ObjectData::PrimativeType>();
+        Material mat = scene.Read<Material>();
+        glm::mat4 mv = scene.Read<glm::mat4>();
+        objects.emplace_back(objType, mat, mv);
+    }
+
+    std::vector<Light> lights;
+    uint32_t lightCount = scene.Read<uint32_t>();
+    for (uint32_t ii = 0; ii < lightCount; ++ii) {
+        // Positions were already transformed into scene space by the coordinator
+        Light light(scene.Read<LightProperties>(), glm::mat4(1.f));
+        light.lightPosition = scene.Read<glm::vec4>();
+        lights.push_back(light);
+    }
+
+    std::cout << "Received a scene with " << objectCount << " objects and " << lightCount << " lights.\n";
+
+    // Every job is traced as a full tile, edge tiles are cropped before sending
+    Camera camera(width, height, fov);
+    camera.Crop(width, height, 0, 0, tileSize, tileSize);
+    std::vector<Ray3D> rays;
+    camera.GenerateRays(rays);
+
+    OpenCLRaytracer tracer(objects, lights, rays, tileSize, tileSize, maxBounces);
+    IRaytracer& raytracer = (IRaytracer&)tracer;
+    raytracer.SetOutputSettings(renderSettings.output);
+    raytracer.SetDenoiseSettings(renderSettings.denoise);
+    raytracer.SetTemporalSettings(renderSettings.temporal);
+    raytracer.SetLightSamplingSettings(renderSettings.lightSampling);
+    raytracer.SetQualitySettings(renderSettings.quality);
+
+    const size_t bytesPerPixel = BytesPerPixel(renderSettings.output.format);
+
+    while (ReceiveFarmMessage(connection, type, payload) && type == FarmMessage::job) {
+        Metrics::ReportIfRequested(std::cout);
+
+        ByteReader job(payload);
+        uint64_t jobIndex = job.Read<uint64_t>();
+        camera.position = job.Read<glm::vec3>();
+        camera.yaw = job.Read<float>();
+        camera.pitch = job.Read<float>();
+        uint32_t x = job.Read<uint32_t>();
+        uint32_t y = job.Read<uint32_t>();
+        uint32_t jobWidth = job.Read<uint32_t>();
+        uint32_t jobHeight = job.Read<uint32_t>();
+
+        // The raytracer renders at the camera's resolution, so it is given the tile rather than the whole frame
+        camera.Crop(width, height, x, y, tileSize, tileSize);
+        camera.GenerateRays(rays);
+        raytracer.SetCamera(camera);
+
+        const Frame& frame = raytracer.Render();
+        const uint8_t* pixels = (const uint8_t*)frame.pixels;
+
+        ByteWriter result;
+        result.Write(jobIndex);
+        for (uint32_t row = 0; row < jobHeight; ++row) {
+            const uint8_t* rowStart = pixels + row * tileSize * bytesPerPixel;
+            result.data.insert(result.data.end(), rowStart, rowStart + jobWidth * bytesPerPixel);
+        }
+
+        if (!SendFarmMessage(connection, FarmMessage::result, result.data)) break;
+    }
+}
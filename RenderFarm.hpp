@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Camera.hpp"
+#include "Denoiser.hpp"
+#include "Frame.hpp"
+#include "FrameBudget.hpp"
+#include "Light.hpp"
+#include "LightTree.hpp"
+#include "ObjectData.hpp"
+#include "Socket.hpp"
+
+// Messages are a FarmMessageHeader followed by size bytes of payload. Nodes are expected to share endianness and float layout.
+enum class FarmMessage : uint32_t {
+    // Coordinator to worker, sent once on connect
+    scene,
+    // Coordinator to worker, one tile of one frame
+    job,
+    // Worker to coordinator, the packed pixels of a finished job
+    result,
+    shutdown
+};
+
+struct FarmMessageHeader {
+    FarmMessage type;
+    uint32_t size;
+};
+
+struct FarmSettings {
+    uint16_t port = 7878;
+    // Jobs are square tiles, edge tiles are traced padded and cropped
+    uint32_t tileSize = 128;
+    // A job is handed to another idle worker once it has been out this many times longer than the average job
+    double slowJobFactor = 4.;
+    double minJobTimeout = 2.;
+};
+
+// Raytracer settings every worker applies, so the farm renders what a local render with the same flags would.
+// Workers denoise each tile on its own and only reproject from the tiles they traced before.
+struct FarmRenderSettings {
+    OutputSettings output;
+    DenoiseSettings denoise;
+    TemporalSettings temporal;
+    LightSamplingSettings lightSampling;
+    QualitySettings quality;
+};
+
+// Loads nothing itself, it ships the scene it is given to every worker that connects and splits frames into tile jobs.
+// Jobs of lost workers are re-queued and jobs stuck on slow workers are duplicated, the first result wins.
+class RenderCoordinator
+{
+public:
+    // Workers also tone map and pack with renderSettings.output, so results come back in the final format
+    RenderCoordinator(const std::vector<ObjectData>& objects, const std::vector<Light>& lights, size_t width, size_t height, float fov, unsigned int maxBounces,
+        const FarmRenderSettings& renderSettings, const FarmSettings& settings);
+    ~RenderCoordinator();
+
+    // Called as frames complete, not necessarily in order. The frame's pixels are only valid during the call.
+    typedef std::function<void(size_t frameIndex, const Frame& frame)> FrameCallback;
+
+    // Blocks until every frame has been returned, waiting for workers to connect if there are none
+    void RenderFrames(const std::vector<Camera>& cameras, const FrameCallback& onFrame);
+    // o_frame points into o_pixels
+    void RenderFrame(const Camera& camera, std::vector<uint8_t>& o_pixels, Frame& o_frame);
+
+private:
+    struct Job {
+        size_t frame;
+        uint32_t x, y, width, height;
+        bool done = false;
+        // Of the most recent copy, so a slow job is only duplicated once per timeout
+        std::chrono::steady_clock::time_point dispatchTime;
+    };
+
+    struct Worker {
+        Socket socket;
+        // Index into jobs, or -1 while idle
+        int64_t job = -1;
+        std::chrono::steady_clock::time_point dispatchTime;
+    };
+
+    void AcceptWorker();
+    void DropWorker(Worker& worker, std::deque<size_t>& pending);
+    bool Dispatch(Worker& worker, size_t jobIndex, const std::vector<Camera>& cameras);
+    // A job that has been out too long on another worker, or -1
+    int64_t FindSlowJob(size_t idleWorker) const;
+
+    std::vector<uint8_t> scenePayload;
+    const size_t width, height;
+    const PixelFormat format;
+    const FarmSettings settings;
+
+    Socket listener;
+    std::vector<Worker> workers;
+    std::vector<Job> jobs;
+
+    // Running average of job round trips, in seconds
+    double averageJobTime = 0.;
+    size_t finishedJobs = 0;
+};
+
+// Connects to a coordinator and renders its jobs until told to shut down or the connection drops
+class RenderWorker
+{
+public:
+    RenderWorker(const std::string& host, uint16_t port);
+
+    void Run();
+
+private:
+    Socket connection;
+};
+
+bool SendFarmMessage(Socket& socket, FarmMessage type, const std::vector<uint8_t>& payload);
+bool ReceiveFarmMessage(Socket& socket, FarmMessage& o_type, std::vector<uint8_t>& o_payload);
@@ -0,0 +1,67 @@
+#include "SceneAnimation.hpp"
+
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+glm::mat4 AnimatedTransform::Evaluate(float time) const
+{
+    glm::vec4 values = keys.front().values;
+
+    if (time >= keys.back().time) {
+        values = keys.back().values;
+    }
+    else if (time > keys.front().time) {
+        auto next = upper_bound(keys.begin(), keys.end(), time, [](float t, const TransformKey& key) { return t < key.time; });
+        auto prev = next - 1;
+        float blend = (time - prev->time) / (next->time - prev->time);
+        values = glm::mix(prev->values, next->values, blend);
+    }
+
+    switch (type) {
+    case Type::translate:
+        return glm::translate(glm::mat4(1.f), glm::vec3(values));
+    case Type::scale:
+        return glm::scale(glm::mat4(1.f), glm::vec3(values));
+    case Type::rotate:
+    default:
+        return glm::rotate(glm::mat4(1.f), glm::radians(values.x), glm::normalize(glm::vec3(values.y, values.z, values.w)));
+    }
+}
+
+bool SceneAnimation::IsAnimated() const
+{
+    for (const AnimatedTransform& transform : transforms) {
+        if (transform.keys.size() > 1) return true;
+    }
+    return false;
+}
+
+float SceneAnimation::Duration() const
+{
+    float duration = 0.f;
+    for (const AnimatedTransform& transform : transforms) {
+        duration = max(duration, transform.keys.back().time);
+    }
+    return duration;
+}
+
+void SceneAnimation::Evaluate(float time, std::vector<ObjectData>& objects, std::vector<Light>& lights) const
+{
+    // Parents are always declared before their children, so one pass resolves the hierarchy
+    vector<glm::mat4> modelviews(transforms.size());
+    for (size_t ii = 0; ii < transforms.size(); ++ii) {
+        const glm::mat4& parent = (transforms[ii].parent < 0) ? root : modelviews[transforms[ii].parent];
+        modelviews[ii] = parent * transforms[ii].Evaluate(time);
+    }
+
+    for (size_t ii = 0; ii < objects.size() && ii < objectTransforms.size(); ++ii) {
+        objects[ii].SetTransform((objectTransforms[ii] < 0) ? root : modelviews[objectTransforms[ii]]);
+    }
+
+    for (size_t ii = 0; ii < lights.size() && ii < lightTransforms.size(); ++ii) {
+        const glm::mat4& modelview = (lightTransforms[ii] < 0) ? root : modelviews[lightTransforms[ii]];
+        lights[ii].lightPosition = modelview * glm::vec4(0.f, 0.f, 0.f, 1.f);
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "ObjectData.hpp"
+#include "Light.hpp"
+
+struct TransformKey {
+    // Seconds
+    float time;
+    // x y z for translate and scale, angle in degrees then axis for rotate
+    glm::vec4 values;
+};
+
+struct AnimatedTransform {
+    enum class Type {
+        translate,
+        scale,
+        rotate
+    };
+
+    Type type;
+    // Enclosing transform, or -1 for the scene root
+    int parent;
+    // Sorted by time, held constant before the first and after the last
+    std::vector<TransformKey> keys;
+
+    glm::mat4 Evaluate(float time) const;
+};
+
+// The transform hierarchy of a loaded scene, kept so objects and lights can be re-placed at any time
+class SceneAnimation
+{
+public:
+    bool IsAnimated() const;
+    // Time of the last key, in seconds
+    float Duration() const;
+
+    // Rewrites the transforms of the objects and the positions of the lights loaded alongside this animation
+    void Evaluate(float time, std::vector<ObjectData>& objects, std::vector<Light>& lights) const;
+
+private:
+    friend class SceneLoader;
+
+    glm::mat4 root{ 1.f };
+    std::vector<AnimatedTransform> transforms;
+    // Innermost enclosing transform of each object and light, or -1
+    std::vector<int> objectTransforms, lightTransforms;
+};
@@ -2,6 +2,7 @@
 #include <stack>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -30,6 +31,12 @@ void SceneLoader::Init(const std::string& sceneFileLoc) {
 }
 
 void SceneLoader::Load(const std::string& i_sceneFileLoc, std::vector<ObjectData>& o_objects, std::vector<Light>& o_lights)
+{
+    SceneAnimation animation;
+    Load(i_sceneFileLoc, o_objects, o_lights, animation);
+}
+
+void SceneLoader::Load(const std::string& i_sceneFileLoc, std::vector<ObjectData>& o_objects, std::vector<Light>& o_lights, SceneAnimation& o_animation)
 {
     Init(i_sceneFileLoc);
 
@@ -37,7 +44,7 @@ void SceneLoader::Load(const std::string& i_sceneFileLoc, std::vector<ObjectData
     stringstream stream;
 
     ParseHeader();
-    ParseBody(o_objects, o_lights);
+    ParseBody(o_objects, o_lights, o_animation);
 }
 
 enum class HeaderParseItem {
@@ -207,7 +214,7 @@ void SceneLoader::ParseHeader() {
     // TODO: add validation step for defined materials
 }
 
-void SceneLoader::ParseBody(std::vector<ObjectData>& o_objects, std::vector<Light>& o_lights) {
+void SceneLoader::ParseBody(std::vector<ObjectData>& o_objects, std::vector<Light>& o_lights, SceneAnimation& o_animation) {
     stack<glm::mat4> modelview;
     modelview.push(glm::mat4(1.f));
 
@@ -215,6 +222,24 @@ void SceneLoader::ParseBody(std::vector<ObjectData>& o_objects, std::vector<Ligh
     modelview.top() *= glm::lookAt(glm::vec3(0, 0, 10), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
     modelview.push(modelview.top());
 
+    o_animation = SceneAnimation();
+    o_animation.root = modelview.top();
+
+    // Index into o_animation.transforms of the transform each modelview level came from, -1 at the root
+    stack<int> transformIndex;
+    transformIndex.push(-1);
+    transformIndex.push(-1);
+
+    auto pushTransform = [&](AnimatedTransform::Type type, const glm::vec4& values) {
+        AnimatedTransform transform;
+        transform.type = type;
+        transform.parent = transformIndex.top();
+        transform.keys.push_back({ 0.f, values });
+
+        o_animation.transforms.push_back(transform);
+        transformIndex.push((int)o_animation.transforms.size() - 1);
+    };
+
     string line;
     size_t currentIndent;
     stringstream stream;
@@ -228,6 +253,7 @@ void SceneLoader::ParseBody(std::vector<ObjectData>& o_objects, std::vector<Ligh
         while (lastIndent > currentIndent) {
             lastIndent -= 2;
             modelview.pop();
+            transformIndex.pop();
         }
 
         stream = stringstream(line);
@@ -252,6 +278,7 @@ void SceneLoader::ParseBody(std::vector<ObjectData>& o_objects, std::vector<Ligh
             }
 
             o_objects.emplace_back(type, materials.at(propName), modelview.top());
+            o_animation.objectTransforms.push_back(transformIndex.top());
         }
         else if (command == "light") {
             if (!(stream >> propName)) {
@@ -259,6 +286,7 @@ void SceneLoader::ParseBody(std::vector<ObjectData>& o_objects, std::vector<Ligh
             }
 
             o_lights.emplace_back(lightProperties.at(propName), modelview.top());
+            o_animation.lightTransforms.push_back(transformIndex.top());
         }
         else if (command == "translate") {
             for (int ii = 0; ii < 3; ++ii) {
@@ -268,6 +296,7 @@ void SceneLoader::ParseBody(std::vector<ObjectData>& o_objects, std::vector<Ligh
             }
             modelview.push(modelview.top());
             modelview.top() *= glm::translate(glm::mat4(1.f), glm::vec3(floats));
+            pushTransform(AnimatedTransform::Type::translate, floats);
 
             // Indent future lines to apply this transstring_formation
             lastIndent += 2;
@@ -280,6 +309,7 @@ void SceneLoader::ParseBody(std::vector<ObjectData>& o_objects, std::vector<Ligh
             }
             modelview.push(modelview.top());
             modelview.top() *= glm::scale(glm::mat4(1.f), glm::vec3(floats));
+            pushTransform(AnimatedTransform::Type::scale, floats);
 
             // Indent future lines to apply this transstring_formation
             lastIndent += 2;
@@ -292,10 +322,35 @@ void SceneLoader::ParseBody(std::vector<ObjectData>& o_objects, std::vector<Ligh
             }
             modelview.push(modelview.top());
             modelview.top() *= glm::rotate(glm::mat4(1.f), glm::radians(floats.x), glm::normalize(glm::vec3(floats.y, floats.z, floats.w)));
+            pushTransform(AnimatedTransform::Type::rotate, floats);
 
             // Indent future lines to apply this transstring_formation
             lastIndent += 2;
         }
+        else if (command == "key") {
+            if (transformIndex.top() < 0) {
+                throw runtime_error(string_format("Error parsing scene file at line %d:\n\tkey must be indented under a translate, scale or rotate", lineNum));
+            }
+
+            AnimatedTransform& transform = o_animation.transforms[transformIndex.top()];
+            int valueCount = (transform.type == AnimatedTransform::Type::rotate) ? 4 : 3;
+
+            float time;
+            if (!(stream >> time)) {
+                throw runtime_error(string_format("Error parsing scene file at line %d:\n\tkey expects %d arguments, found 0\n\tkey <time in seconds> <transform arguments>", lineNum, valueCount + 1));
+            }
+            floats = glm::vec4(0.f, 0.f, 0.f, 0.f);
+            for (int ii = 0; ii < valueCount; ++ii) {
+                if (!(stream >> floats[ii])) {
+                    throw runtime_error(string_format("Error parsing scene file at line %d:\n\tkey expects %d arguments, found %d\n\tkey <time in seconds> <transform arguments>", lineNum, valueCount + 1, ii + 1));
+                }
+            }
+
+            // A key at an existing time replaces it, including the transform's own arguments at time 0
+            auto key = lower_bound(transform.keys.begin(), transform.keys.end(), time, [](const TransformKey& existing, float t) { return existing.time < t; });
+            if (key != transform.keys.end() && key->time == time) key->values = floats;
+            else transform.keys.insert(key, { time, floats });
+        }
         else {
             throw runtime_error(string_format("Error parsing scene file at line %d:\n\tunsupported command '%s' in body", lineNum, command.c_str()));
         }
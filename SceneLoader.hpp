@@ -6,19 +6,22 @@
 #include <vector>
 #include "ObjectData.hpp"
 #include "Light.hpp"
+#include "SceneAnimation.hpp"
 #include <map>
 
 class SceneLoader
 {
 public:
     void Load(const std::string& i_sceneFileLoc, std::vector<ObjectData>& o_objects, std::vector<Light>& o_lights);
+    // Objects and lights are placed at time 0, o_animation can re-place them at any other time
+    void Load(const std::string& i_sceneFileLoc, std::vector<ObjectData>& o_objects, std::vector<Light>& o_lights, SceneAnimation& o_animation);
 
 private:
     void Init(const std::string& i_sceneFileLoc);
 
     void ParseHeader();
 
-    void ParseBody(std::vector<ObjectData>& o_objects, std::vector<Light>& o_lights);
+    void ParseBody(std::vector<ObjectData>& o_objects, std::vector<Light>& o_lights, SceneAnimation& o_animation);
 
     bool GetNextLine(std::string& o_line, size_t& o_indent);
 
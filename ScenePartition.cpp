@@ -0,0 +1,74 @@
+#include "ScenePartition.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+void ScenePartition::Build(const std::vector<ObjectData>& objects, size_t maxChunkObjects, std::vector<size_t>& o_order, std::vector<SceneChunk>& o_chunks)
+{
+    o_order.resize(objects.size());
+    o_chunks.clear();
+    if (objects.empty()) return;
+
+    vector<glm::vec3> centers(objects.size());
+    for (size_t ii = 0; ii < objects.size(); ++ii) {
+        glm::vec3 boundsMin, boundsMax;
+        Bounds(objects[ii], boundsMin, boundsMax);
+        centers[ii] = 0.5f * (boundsMin + boundsMax);
+        o_order[ii] = ii;
+    }
+
+    BuildNode(centers, o_order, 0, o_order.size(), max<size_t>(maxChunkObjects, 1), o_chunks);
+
+    // Chunk bounds have to hold whole objects, not just their centers
+    for (SceneChunk& chunk : o_chunks) {
+        Bounds(objects[o_order[chunk.first]], chunk.boundsMin, chunk.boundsMax);
+        for (size_t ii = chunk.first + 1; ii < chunk.first + chunk.count; ++ii) {
+            glm::vec3 boundsMin, boundsMax;
+            Bounds(objects[o_order[ii]], boundsMin, boundsMax);
+            chunk.boundsMin = glm::min(chunk.boundsMin, boundsMin);
+            chunk.boundsMax = glm::max(chunk.boundsMax, boundsMax);
+        }
+    }
+}
+
+void ScenePartition::Bounds(const ObjectData& object, glm::vec3& o_min, glm::vec3& o_max)
+{
+    // Matches the shapes in ObjectData::Raycast, a radius 1 sphere and a unit box
+    float halfExtent = (object.type == ObjectData::PrimativeType::sphere) ? 1.f : 0.5f;
+
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec4 objSpaceCorner((corner & 1) ? halfExtent : -halfExtent, (corner & 2) ? halfExtent : -halfExtent, (corner & 4) ? halfExtent : -halfExtent, 1.f);
+        glm::vec3 sceneCorner(object.mv * objSpaceCorner);
+
+        o_min = (corner == 0) ? sceneCorner : glm::min(o_min, sceneCorner);
+        o_max = (corner == 0) ? sceneCorner : glm::max(o_max, sceneCorner);
+    }
+}
+
+void ScenePartition::BuildNode(const std::vector<glm::vec3>& centers, std::vector<size_t>& order, size_t begin, size_t end, size_t maxChunkObjects, std::vector<SceneChunk>& o_chunks)
+{
+    if (end - begin <= maxChunkObjects) {
+        SceneChunk chunk;
+        chunk.first = begin;
+        chunk.count = end - begin;
+        o_chunks.push_back(chunk);
+        return;
+    }
+
+    glm::vec3 centersMin = centers[order[begin]], centersMax = centersMin;
+    for (size_t ii = begin + 1; ii < end; ++ii) {
+        centersMin = glm::min(centersMin, centers[order[ii]]);
+        centersMax = glm::max(centersMax, centers[order[ii]]);
+    }
+
+    // Median split along the widest axis
+    glm::vec3 extent = centersMax - centersMin;
+    int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    size_t middle = begin + (end - begin) / 2;
+    nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+        [&](size_t lhs, size_t rhs) { return centers[lhs][axis] < centers[rhs][axis]; });
+
+    BuildNode(centers, order, begin, middle, maxChunkObjects, o_chunks);
+    BuildNode(centers, order, middle, end, maxChunkObjects, o_chunks);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "ObjectData.hpp"
+
+struct StreamingSettings {
+    // Most objects on the device at once, 0 only streams scenes too large for the device to hold
+    size_t chunkObjects = 0;
+};
+
+struct SceneChunk {
+    glm::vec3 boundsMin{ 0.f, 0.f, 0.f }, boundsMax{ 0.f, 0.f, 0.f };
+    // Range of the partition's object order
+    size_t first = 0, count = 0;
+};
+
+// Splits the objects into spatially coherent chunks, so rays can be traced against a scene one chunk at a time
+class ScenePartition
+{
+public:
+    // o_order lists object indices chunk by chunk
+    static void Build(const std::vector<ObjectData>& objects, size_t maxChunkObjects, std::vector<size_t>& o_order, std::vector<SceneChunk>& o_chunks);
+
+    // Scene space bounds of the object's transformed unit shape
+    static void Bounds(const ObjectData& object, glm::vec3& o_min, glm::vec3& o_max);
+
+private:
+    static void BuildNode(const std::vector<glm::vec3>& centers, std::vector<size_t>& order, size_t begin, size_t end, size_t maxChunkObjects, std::vector<SceneChunk>& o_chunks);
+};
@@ -0,0 +1,66 @@
+#include "SequenceRenderer.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include "PPMExporter.hpp"
+#include "Metrics.hpp"
+
+using namespace std;
+
+SequenceRenderer::SequenceRenderer(IRaytracer& raytracer, const SceneAnimation& animation, std::vector<ObjectData>& objects, std::vector<Light>& lights)
+    : raytracer(raytracer), animation(animation), objects(objects), lights(lights) { }
+
+void SequenceRenderer::Render(const SequenceSettings& settings)
+{
+    size_t frameCount = settings.frameCount;
+    if (frameCount == 0)
+        frameCount = (size_t)(animation.Duration() * settings.framesPerSecond) + 1;
+
+    // Static scenes are traced once, every later frame exports the cached one
+    bool animated = animation.IsAnimated();
+
+    // The scene for the next frame is built here while the raytracer still reads objects and lights
+    std::vector<ObjectData> nextObjects = objects;
+    std::vector<Light> nextLights = lights;
+
+    animation.Evaluate(0.f, objects, lights);
+    raytracer.Invalidate(SceneChange::geometry);
+    raytracer.Invalidate(SceneChange::lights);
+    raytracer.Submit();
+
+    for (size_t frameIndex = 0; frameIndex < frameCount; ++frameIndex) {
+        Metrics::ReportIfRequested(std::cout);
+        ScopedTimer frameTimer(MetricStage::frame);
+
+        bool hasNext = animated && frameIndex + 1 < frameCount;
+        if (hasNext)
+            animation.Evaluate((frameIndex + 1) / settings.framesPerSecond, nextObjects, nextLights);
+
+        const Frame& frame = raytracer.Render();
+
+        // The frame stays valid until the next Render(), so it can be written out while the next one traces
+        if (hasNext) {
+            objects.swap(nextObjects);
+            lights.swap(nextLights);
+            raytracer.Invalidate(SceneChange::geometry);
+            raytracer.Invalidate(SceneChange::lights);
+            raytracer.Submit();
+        }
+
+        ScopedTimer timer(MetricStage::fileExport);
+        PPMExporter::ExportP3(FramePath(settings.outFileLoc, frameIndex), frame);
+    }
+}
+
+std::string SequenceRenderer::FramePath(const std::string& outFileLoc, size_t frameIndex)
+{
+    char number[16];
+    snprintf(number, sizeof(number), "_%04u", (unsigned int)frameIndex);
+
+    size_t extension = outFileLoc.find_last_of('.');
+    size_t directory = outFileLoc.find_last_of("/\\");
+    if (extension == std::string::npos || (directory != std::string::npos && extension < directory))
+        return outFileLoc + number;
+
+    return outFileLoc.substr(0, extension) + number + outFileLoc.substr(extension);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "IRaytracer.hpp"
+#include "SceneAnimation.hpp"
+
+struct SequenceSettings {
+    // 0 covers the animation from its first key to its last
+    size_t frameCount = 0;
+    float framesPerSecond = 24.f;
+    // Frame numbers are inserted before the extension
+    std::string outFileLoc;
+};
+
+// Renders an animated scene with one raytracer, so programs and device buffers are reused by every frame.
+// The next frame's scene is evaluated while the device traces the current one, and each frame is exported while the next traces.
+class SequenceRenderer
+{
+public:
+    // objects and lights must be the vectors the raytracer was created with
+    SequenceRenderer(IRaytracer& raytracer, const SceneAnimation& animation, std::vector<ObjectData>& objects, std::vector<Light>& lights);
+
+    void Render(const SequenceSettings& settings);
+
+    static std::string FramePath(const std::string& outFileLoc, size_t frameIndex);
+
+private:
+    IRaytracer& raytracer;
+    const SceneAnimation& animation;
+    std::vector<ObjectData>& objects;
+    std::vector<Light>& lights;
+};
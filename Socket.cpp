@@ -0,0 +1,208 @@
+#include "Socket.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+
+typedef int socklen_t;
+#define closesocket_handle(s) closesocket(s)
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket_handle(s) ::close(s)
+#endif
+
+using namespace std;
+
+namespace {
+    // Winsock has to be started once per process before any other call
+    void StartNetworking()
+    {
+#ifdef _WIN32
+        struct WinsockStartup {
+            WinsockStartup() {
+                WSADATA data;
+                if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+                    throw std::runtime_error("Failed to start Winsock.");
+            }
+            ~WinsockStartup() { WSACleanup(); }
+        };
+        static WinsockStartup startup;
+#endif
+    }
+
+    SOCKET Native(uintptr_t handle) { return (SOCKET)handle; }
+}
+
+const uintptr_t Socket::InvalidHandle;
+
+Socket::~Socket()
+{
+    Close();
+}
+
+Socket::Socket(Socket&& other) : handle(other.handle)
+{
+    other.handle = InvalidHandle;
+}
+
+Socket& Socket::operator=(Socket&& other)
+{
+    if (this != &other) {
+        Close();
+        handle = other.handle;
+        other.handle = InvalidHandle;
+    }
+    return *this;
+}
+
+Socket Socket::Listen(uint16_t port)
+{
+    StartNetworking();
+
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET)
+        throw std::runtime_error("Failed to create a socket.");
+    Socket listener((uintptr_t)sock);
+
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if (::bind(sock, (const sockaddr*)&address, sizeof(address)) != 0 || ::listen(sock, SOMAXCONN) != 0)
+        throw std::runtime_error("Failed to listen on port " + to_string(port) + ".");
+
+    return listener;
+}
+
+Socket Socket::Connect(const std::string& host, uint16_t port)
+{
+    StartNetworking();
+
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* addresses = NULL;
+    if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &addresses) != 0 || addresses == NULL)
+        throw std::runtime_error("Failed to resolve " + host + ".");
+
+    Socket connection;
+    for (addrinfo* address = addresses; address != NULL && !connection.IsOpen(); address = address->ai_next) {
+        SOCKET sock = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (sock == INVALID_SOCKET) continue;
+
+        Socket candidate((uintptr_t)sock);
+        if (::connect(sock, address->ai_addr, (socklen_t)address->ai_addrlen) == 0)
+            connection = std::move(candidate);
+    }
+    freeaddrinfo(addresses);
+
+    if (!connection.IsOpen())
+        throw std::runtime_error("Failed to connect to " + host + ":" + to_string(port) + ".");
+
+    // Messages are written whole, don't hold back the small ones
+    int noDelay = 1;
+    setsockopt(Native(connection.handle), IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+    return connection;
+}
+
+Socket Socket::Accept()
+{
+    SOCKET sock = ::accept(Native(handle), NULL, NULL);
+    if (sock == INVALID_SOCKET)
+        throw std::runtime_error("Failed to accept a connection.");
+
+    int noDelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+    return Socket((uintptr_t)sock);
+}
+
+void Socket::Close()
+{
+    if (!IsOpen()) return;
+
+    closesocket_handle(Native(handle));
+    handle = InvalidHandle;
+}
+
+bool Socket::SendAll(const void* data, size_t size)
+{
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        int chunk = (int)std::min<size_t>(size, 1 << 30);
+#ifdef MSG_NOSIGNAL
+        int sent = (int)::send(Native(handle), bytes, chunk, MSG_NOSIGNAL);
+#else
+        int sent = (int)::send(Native(handle), bytes, chunk, 0);
+#endif
+        if (sent <= 0) return false;
+
+        bytes += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+bool Socket::ReceiveAll(void* data, size_t size)
+{
+    char* bytes = (char*)data;
+    while (size > 0) {
+        int chunk = (int)std::min<size_t>(size, 1 << 30);
+        int received = (int)::recv(Native(handle), bytes, chunk, 0);
+        if (received <= 0) return false;
+
+        bytes += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+std::vector<size_t> Socket::WaitReadable(const std::vector<Socket*>& sockets, int timeoutMs)
+{
+    fd_set readable;
+    FD_ZERO(&readable);
+
+    SOCKET highest = 0;
+    for (Socket* sock : sockets) {
+        FD_SET(Native(sock->handle), &readable);
+        highest = std::max(highest, Native(sock->handle));
+    }
+
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+    std::vector<size_t> ready;
+    // The first argument is ignored by Winsock
+    if (select((int)highest + 1, &readable, NULL, NULL, &timeout) <= 0) return ready;
+
+    for (size_t ii = 0; ii < sockets.size(); ++ii) {
+        if (FD_ISSET(Native(sockets[ii]->handle), &readable))
+            ready.push_back(ii);
+    }
+    return ready;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Blocking TCP socket. Setup failures throw, send and receive report a lost peer by returning false.
+class Socket
+{
+public:
+    Socket() { }
+    ~Socket();
+
+    Socket(Socket&& other);
+    Socket& operator=(Socket&& other);
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    static Socket Listen(uint16_t port);
+    static Socket Connect(const std::string& host, uint16_t port);
+    Socket Accept();
+
+    bool IsOpen() const { return handle != InvalidHandle; }
+    void Close();
+
+    bool SendAll(const void* data, size_t size);
+    bool ReceiveAll(void* data, size_t size);
+
+    // Indices of the sockets that have data or a pending connection, empty on timeout
+    static std::vector<size_t> WaitReadable(const std::vector<Socket*>& sockets, int timeoutMs);
+
+private:
+    static const uintptr_t InvalidHandle = ~(uintptr_t)0;
+
+    explicit Socket(uintptr_t handle) : handle(handle) { }
+
+    uintptr_t handle = InvalidHandle;
+};
@@ -0,0 +1,159 @@
+#include "WorkGroupTuner.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+// Timed launches per candidate, after one warm-up
+static const int BenchmarkRuns = 3;
+// Candidates are timed on a corner of the launch this many items large, rows at most BenchmarkRowWidth wide for 2-D launches,
+// so tuning every candidate costs a fraction of one launch however heavy the kernel is
+static const size_t BenchmarkItems = 1 << 16;
+static const size_t BenchmarkRowWidth = 256;
+
+static size_t roundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+WorkGroupTuner::WorkGroupTuner(const boost::compute::device& device) : device(device)
+{
+    // Driver updates can change what is fastest, so they get a file of their own
+    string deviceId = device.name() + "_" + device.driver_version();
+    for (char& c : deviceId) {
+        if (!isalnum((unsigned char)c)) c = '_';
+    }
+    cacheFileLoc = "worktuning_" + deviceId + ".txt";
+
+    LoadCache();
+}
+
+const LaunchShape& WorkGroupTuner::Tune(boost::compute::kernel& kernel, boost::compute::command_queue& queue, size_t width, size_t height, bool allow2D,
+    const boost::compute::wait_list& events)
+{
+    string name = kernel.name();
+    auto cached = shapes.find(name);
+    if (cached != shapes.end() && (allow2D || cached->second.dimensions == 1))
+        return cached->second;
+
+    // Earlier work on the queue would count against the first candidate
+    events.wait();
+    queue.finish();
+
+    // Kernels skip the items past their own size, so the smaller launch only traces the corner
+    size_t benchWidth = (height > 1) ? min(width, BenchmarkRowWidth) : min(width, BenchmarkItems);
+    size_t benchHeight = min(height, BenchmarkItems / benchWidth);
+
+    LaunchShape best;
+    double bestTime = -1.0;
+    for (const LaunchShape& shape : Candidates(kernel, allow2D)) {
+        try {
+            Enqueue(queue, kernel, shape, benchWidth, benchHeight);
+            queue.finish();
+
+            auto start = chrono::high_resolution_clock::now();
+            for (int run = 0; run < BenchmarkRuns; ++run) {
+                Enqueue(queue, kernel, shape, benchWidth, benchHeight);
+            }
+            queue.finish();
+            double elapsed = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+            if (bestTime < 0.0 || elapsed < bestTime) {
+                best = shape;
+                bestTime = elapsed;
+            }
+        }
+        catch (std::exception&) {
+            // Shapes the driver rejects for this kernel, e.g. out of registers, are skipped
+        }
+    }
+
+    if (bestTime < 0.0)
+        throw std::runtime_error("No work-group size could launch kernel " + name + ".");
+
+    shapes[name] = best;
+    SaveCache();
+    return shapes[name];
+}
+
+boost::compute::event WorkGroupTuner::Enqueue(boost::compute::command_queue& queue, const boost::compute::kernel& kernel, const LaunchShape& shape, size_t width, size_t height,
+    const boost::compute::wait_list& events)
+{
+    if (shape.dimensions == 2) {
+        size_t global[2] = { roundUp(width, shape.local[0]), roundUp(height, shape.local[1]) };
+        return queue.enqueue_nd_range_kernel(kernel, 2, NULL, global, shape.local, events);
+    }
+
+    size_t global = roundUp(width * height, shape.local[0]);
+    return queue.enqueue_nd_range_kernel(kernel, 1, NULL, &global, shape.local, events);
+}
+
+vector<LaunchShape> WorkGroupTuner::Candidates(const boost::compute::kernel& kernel, bool allow2D) const
+{
+    static const size_t sizes1D[] = { 32, 64, 128, 256 };
+    static const size_t sizes2D[][2] = { { 8, 4 }, { 8, 8 }, { 16, 4 }, { 16, 8 }, { 16, 16 }, { 32, 4 }, { 32, 8 } };
+
+    size_t maxGroupSize = kernel.get_work_group_info<size_t>(device, CL_KERNEL_WORK_GROUP_SIZE);
+    vector<size_t> maxItemSizes = device.get_info<vector<size_t>>(CL_DEVICE_MAX_WORK_ITEM_SIZES);
+    auto fits = [&](size_t x, size_t y) {
+        return x * y <= maxGroupSize && maxItemSizes.size() >= 2 && x <= maxItemSizes[0] && y <= maxItemSizes[1];
+    };
+
+    vector<LaunchShape> candidates;
+    for (size_t size : sizes1D) {
+        if (!fits(size, 1)) continue;
+        LaunchShape shape;
+        shape.local[0] = size;
+        candidates.push_back(shape);
+    }
+    if (allow2D) {
+        for (const auto& size : sizes2D) {
+            if (!fits(size[0], size[1])) continue;
+            LaunchShape shape;
+            shape.dimensions = 2;
+            shape.local[0] = size[0];
+            shape.local[1] = size[1];
+            candidates.push_back(shape);
+        }
+    }
+
+    // Kernels heavy enough to fit none of the above still get the largest group they allow
+    if (candidates.empty()) {
+        LaunchShape shape;
+        shape.local[0] = max<size_t>(maxGroupSize, 1);
+        candidates.push_back(shape);
+    }
+
+    return candidates;
+}
+
+void WorkGroupTuner::LoadCache()
+{
+    ifstream cacheFile(cacheFileLoc);
+    string line;
+    while (getline(cacheFile, line)) {
+        istringstream fields(line);
+        string name;
+        LaunchShape shape;
+        if (fields >> name >> shape.dimensions >> shape.local[0] >> shape.local[1] && (shape.dimensions == 1 || shape.dimensions == 2))
+            shapes[name] = shape;
+    }
+}
+
+void WorkGroupTuner::SaveCache() const
+{
+    ofstream cacheFile(cacheFileLoc);
+    if (!cacheFile) {
+        cerr << "Could not write work-group tuning to " << cacheFileLoc << endl;
+        return;
+    }
+
+    cacheFile << "# kernel dimensions localX localY" << endl;
+    for (const auto& entry : shapes) {
+        cacheFile << entry.first << " " << entry.second.dimensions << " " << entry.second.local[0] << " " << entry.second.local[1] << endl;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/compute/device.hpp>
+#include <boost/compute/kernel.hpp>
+#include <boost/compute/command_queue.hpp>
+#include <boost/compute/event.hpp>
+#include <boost/compute/wait_list.hpp>
+
+// Work-group size of a launch, the global size is padded to whole groups and the kernel skips the extra items
+struct LaunchShape {
+    // 1 runs one item per pixel in row-major order, 2 runs over (x, y)
+    cl_uint dimensions = 1;
+    size_t local[2] = { 32, 1 };
+};
+
+// Benchmarks launch shapes on a corner of the first launch of a kernel on a device and remembers the fastest.
+// Results persist in one cache file per device, delete it to re-tune after changing a kernel.
+class WorkGroupTuner
+{
+public:
+    WorkGroupTuner(const boost::compute::device& device);
+
+    // Kernels are told apart by name. Every argument must already be set, as untuned kernels are run several times over
+    // the first items of the launch, so only kernels that give the same result when repeated and that skip items past
+    // their own size can be tuned. events are waited on before benchmarking.
+    // Kernels that only index with get_global_id(0) must not allow 2-D shapes.
+    const LaunchShape& Tune(boost::compute::kernel& kernel, boost::compute::command_queue& queue, size_t width, size_t height, bool allow2D,
+        const boost::compute::wait_list& events = boost::compute::wait_list());
+
+    static boost::compute::event Enqueue(boost::compute::command_queue& queue, const boost::compute::kernel& kernel, const LaunchShape& shape, size_t width, size_t height,
+        const boost::compute::wait_list& events = boost::compute::wait_list());
+
+    const std::string& CacheFileLoc() const { return cacheFileLoc; }
+
+private:
+    std::vector<LaunchShape> Candidates(const boost::compute::kernel& kernel, bool allow2D) const;
+    void LoadCache();
+    void SaveCache() const;
+
+    boost::compute::device device;
+    std::string cacheFileLoc;
+    std::map<std::string, LaunchShape> shapes;
+};
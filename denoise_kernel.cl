@@ -0,0 +1,76 @@
+// B3 spline, matches the weights in Denoiser.cpp
+__constant float kernelWeights[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+inline float distanceSquared(const float3 lhs, const float3 rhs) {
+    float3 diff = lhs - rhs;
+    return dot(diff, diff);
+}
+
+// Launches are either 1-D over the pixels in row-major order or 2-D over (x, y), both padded to whole work-groups.
+// Returns -1 for the padding items.
+inline int pixelIndex(const uint width, const uint height) {
+    if (get_work_dim() == 1) {
+        uint ii = get_global_id(0);
+        return (ii < width * height) ? (int)ii : -1;
+    }
+
+    uint x = get_global_id(0), y = get_global_id(1);
+    return (x < width && y < height) ? (int)(y * width + x) : -1;
+}
+
+// One pass of the edge-aware a-trous wavelet filter, stepWidth doubles every pass.
+// Depth <= 0 marks background pixels.
+__kernel void atrous_filter(const uint width, const uint height, const int stepWidth, const float colorPhi, const float normalPhi, const float depthPhi, const float albedoPhi,
+    __global const float4* colorIn, __global const float* depth, __global const float4* normal, __global const float4* albedo, __global float4* colorOut) {
+    // Get the index of the current element to be processed
+    int ii = pixelIndex(width, height);
+    if (ii < 0) return;
+
+    int x = ii % width;
+    int y = ii / width;
+
+    float4 centerColor = colorIn[ii];
+    float centerDepth = depth[ii];
+
+    // Background pixels have no surface to filter against
+    if (centerDepth <= 0.f) {
+        colorOut[ii] = centerColor;
+        return;
+    }
+
+    float3 centerNormal = normal[ii].xyz;
+    float3 centerAlbedo = albedo[ii].xyz;
+
+    float3 sum = { 0.f, 0.f, 0.f };
+    float weightSum = 0.f;
+
+    for (int dy = -2; dy <= 2; ++dy) {
+        int sy = y + dy * stepWidth;
+        if (sy < 0 || sy >= (int)height) continue;
+
+        for (int dx = -2; dx <= 2; ++dx) {
+            int sx = x + dx * stepWidth;
+            if (sx < 0 || sx >= (int)width) continue;
+
+            int jj = sy * width + sx;
+
+            float sampleDepth = depth[jj];
+            if (sampleDepth <= 0.f) continue;
+
+            float3 sampleColor = colorIn[jj].xyz;
+
+            float colorWeight = exp(-distanceSquared(centerColor.xyz, sampleColor) / colorPhi);
+            float normalWeight = exp(-distanceSquared(centerNormal, normal[jj].xyz) / normalPhi);
+            float depthWeight = exp(-fabs(centerDepth - sampleDepth) / (depthPhi * centerDepth));
+            float albedoWeight = exp(-distanceSquared(centerAlbedo, albedo[jj].xyz) / albedoPhi);
+
+            float weight = kernelWeights[dx + 2] * kernelWeights[dy + 2] * colorWeight * normalWeight * depthWeight * albedoWeight;
+
+            sum += weight * sampleColor;
+            weightSum += weight;
+        }
+    }
+
+    // The center sample always contributes, so weightSum is never 0
+    colorOut[ii] = (float4)(sum / weightSum, centerColor.w);
+}
@@ -15,6 +15,16 @@ typedef struct ObjectData {
     uint type;
 } ObjectData;
 
+// Must match RayHit in IRayQuery.hpp
+typedef struct RayHit {
+    float normal[3];
+    // MAX_FLOAT on a miss
+    float time;
+    // -1 on a miss
+    int object;
+    int spacer[3];
+} RayHit;
+
 const float MAX_FLOAT = 3.402823466e+38F;
 
 bool intersectsWidthBoxSide(float* tMin, float* tMax, float start, float dir) {
@@ -51,22 +61,28 @@ inline void transform(float4* o_vec, const float16* i_mat, const float4* i_vec)
     o_vec->w = i_mat->s3 * i_vec->x + i_mat->s7 * i_vec->y + i_mat->sB * i_vec->z + i_mat->sF * i_vec->w;
 }
 
-__kernel void hittest(const ulong count, __global const ObjectData* objs, __global const Ray* rays, __global float* hits) {
+// One ray of a query batch per work item. Any-hit queries stop at the first object closer than maxTime.
+__kernel void hittest(const ulong count, __global const ObjectData* objs, __global const Ray* rays, const uint rayCount, const uint anyHit, const float maxTime, __global RayHit* hits) {
     // Get the index of the current element to be processed
     int i = get_global_id(0);
+    if (i >= rayCount) return;
 
+    Ray sceneRay = rays[i];
     Ray ray;
 
     // Do the operation
-    float hit = MAX_FLOAT;
+    float hit = maxTime;
+    int hitObject = -1;
+    float4 objSpaceNormal = (float4)(0.f, 0.f, 0.f, 0.f);
 
     for (int objIndex = 0; objIndex < count; ++objIndex) {
-        const ObjectData* obj = objs + objIndex;
+        // Only the fields needed to intersect, the materials are never read
+        const float16 mvInverse = objs[objIndex].mvInverse;
 
-        transform(&ray.start, &obj->mvInverse, &rays[i].start);
-        transform(&ray.direction, &obj->mvInverse, &rays[i].direction);
+        transform(&ray.start, &mvInverse, &sceneRay.start);
+        transform(&ray.direction, &mvInverse, &sceneRay.direction);
 
-        switch (obj->type) {
+        switch (objs[objIndex].type) {
         case 0: // Sphere
         {
             // Solve quadratic
@@ -93,10 +109,14 @@ __kernel void hittest(const ulong count, __global const ObjectData* objs, __glob
             // object is fully behind camera
             if (tMin < 0) continue;
 
-            if (hit < tMin) continue;
-            
+            // already hit a closer object
+            if (hit <= tMin) continue;
+
             hit = tMin;
-            continue;
+            hitObject = objIndex;
+            objSpaceNormal = ray.start + tMin * ray.direction;
+            objSpaceNormal.w = 0.f;
+            break;
         }
 
         case 1: // Box
@@ -127,7 +147,7 @@ __kernel void hittest(const ulong count, __global const ObjectData* objs, __glob
 
             float4 objSpaceIntersection = { ray.start + tHit * ray.direction };
 
-            float4 objSpaceNormal = { 0.f, 0.f, 0.f, 0.f };
+            objSpaceNormal = (float4)(0.f, 0.f, 0.f, 0.f);
             if (objSpaceIntersection.x > 0.4998f) objSpaceNormal.x += 1.f;
             else if (objSpaceIntersection.x < -0.4998f) objSpaceNormal.x -= 1.f;
 
@@ -137,15 +157,35 @@ __kernel void hittest(const ulong count, __global const ObjectData* objs, __glob
             if (objSpaceIntersection.z > 0.4998f) objSpaceNormal.z += 1.f;
             else if (objSpaceIntersection.z < -0.4998f) objSpaceNormal.z -= 1.f;
 
-            objSpaceNormal = normalize(objSpaceNormal);
-
             hit = tHit;
-            continue;
+            hitObject = objIndex;
+            break;
         }
 
+        default:
+            continue;
         }
+
+        if (anyHit) break;
     }
 
-    if (hit < MAX_FLOAT) hits[i] = hit;
-}
+    RayHit result;
+    result.time = MAX_FLOAT;
+    result.object = hitObject;
+    result.normal[0] = result.normal[1] = result.normal[2] = 0.f;
+
+    if (hitObject >= 0) {
+        // Only the winning object's normal is taken to scene space, matching ObjectData::Raycast
+        const float16 mvInverseTranspose = objs[hitObject].mvInverseTranspose;
+        float4 normal;
+        transform(&normal, &mvInverseTranspose, &objSpaceNormal);
+        float3 sceneNormal = normalize(normal.xyz);
+
+        result.time = hit;
+        result.normal[0] = sceneNormal.x;
+        result.normal[1] = sceneNormal.y;
+        result.normal[2] = sceneNormal.z;
+    }
 
+    hits[i] = result;
+}
@@ -0,0 +1,40 @@
+// Must match ToneMapping in Frame.hpp
+#define TONE_MAPPING_CLAMP 0
+#define TONE_MAPPING_REINHARD 1
+
+inline float4 toneMap(const float4 color, const float exposure, const float invGamma, const uint toneMapping) {
+    float3 mapped = color.xyz * exposure;
+    if (toneMapping == TONE_MAPPING_REINHARD)
+        mapped = mapped / (1.f + mapped);
+    mapped = clamp(mapped, 0.f, 1.f);
+    return (float4)(pow(mapped, (float3)(invGamma)), color.w);
+}
+
+__kernel void pack_rgba32f(const uint count, const float exposure, const float invGamma, const uint toneMapping, __global const float4* pixelData, __global float4* packed) {
+    int ii = get_global_id(0);
+    if (ii >= count) return;
+
+    packed[ii] = toneMap(pixelData[ii], exposure, invGamma, toneMapping);
+}
+
+__kernel void pack_rgba16f(const uint count, const float exposure, const float invGamma, const uint toneMapping, __global const float4* pixelData, __global half* packed) {
+    int ii = get_global_id(0);
+    if (ii >= count) return;
+
+    vstore_half4_rte(toneMap(pixelData[ii], exposure, invGamma, toneMapping), ii, packed);
+}
+
+__kernel void pack_rgb10a2(const uint count, const float exposure, const float invGamma, const uint toneMapping, __global const float4* pixelData, __global uint* packed) {
+    int ii = get_global_id(0);
+    if (ii >= count) return;
+
+    uint4 q = convert_uint4_sat_rte(toneMap(pixelData[ii], exposure, invGamma, toneMapping) * (float4)(1023.f, 1023.f, 1023.f, 3.f));
+    packed[ii] = q.x | (q.y << 10) | (q.z << 20) | (q.w << 30);
+}
+
+__kernel void pack_rgba8(const uint count, const float exposure, const float invGamma, const uint toneMapping, __global const float4* pixelData, __global uchar4* packed) {
+    int ii = get_global_id(0);
+    if (ii >= count) return;
+
+    packed[ii] = convert_uchar4_sat_rte(toneMap(pixelData[ii], exposure, invGamma, toneMapping) * 255.f);
+}
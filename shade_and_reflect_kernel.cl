@@ -15,6 +15,8 @@ typedef struct HitRecord {
     float3 normal;
     float3 reflection;
     float time;
+    // Index into the objects given to raycast
+    int object;
 } HitRecord;
 
 typedef struct ObjectData {
@@ -28,6 +30,24 @@ typedef struct Light {
     float4 position;
 } Light;
 
+// Primary hit kept while the geometry and camera stay the same, so shading changes skip the first raycast.
+// Must match cl_PrimaryHit in OpenCLRaytracer.hpp
+typedef struct PrimaryHit {
+    float4 intersection, normal, reflection;
+    float time;
+    // -1 where the ray hit nothing, the material is looked up again as it may have changed
+    int object;
+    int spacer[2];
+} PrimaryHit;
+
+// Must match cl_LightNode in OpenCLRaytracer.hpp
+typedef struct LightNode {
+    // w of boundsMin holds the summed power of the lights below
+    float4 boundsMin, boundsMax;
+    // Left child, right child and light index, -1 where unused
+    int4 links;
+} LightNode;
+
 const float MAX_FLOAT = 3.402823466e+38F;
 
 bool intersectsWidthBoxSide(float* tMin, float* tMax, float start, float dir) {
@@ -117,6 +137,7 @@ bool raycast(const ulong count, const ObjectData* objs, const Ray* viewspaceRay,
             transform(&normal, &obj->mv, &objSpaceNormal);
             hit->normal = normalize(normal.xyz);
             hit->mat = obj->mat;
+            hit->object = objIndex;
             continue;
         }
 
@@ -164,6 +185,7 @@ bool raycast(const ulong count, const ObjectData* objs, const Ray* viewspaceRay,
             transform(&normal, &obj->mv, &objSpaceNormal);
             hit->normal = normalize(normal.xyz);
             hit->mat = obj->mat;
+            hit->object = objIndex;
             continue;
         }
 
@@ -176,83 +198,252 @@ bool raycast(const ulong count, const ObjectData* objs, const Ray* viewspaceRay,
     return true;
 }
 
+// Per-pixel work for the cost heatmap: x counts object intersection tests, y shadow rays and z bounces
+inline bool countedRaycast(const ulong count, const ObjectData* objs, const Ray* viewspaceRay, HitRecord* hit, uint4* cost) {
+    cost->x += count;
+    return raycast(count, objs, viewspaceRay, hit);
+}
+
 inline float3 componentWiseMultiply(const float3 lhs, const float3 rhs)
 {
     return (float3)(lhs.x * rhs.x, lhs.y * rhs.y, lhs.z * rhs.z);
 }
 
-float3 shade(const ulong OBJECT_COUNT, __global const ObjectData* objs, const ulong LIGHT_COUNT, __global const Light* lights, const HitRecord* hit) {
+// Diffuse and specular from one light if nothing is in the way, zero when facing away from it.
+// o_rayToLight hits a blocker somewhere in [0, 1).
+float3 unshadowedLight(__global const Light* light, const HitRecord* hit, const float3 eye, Ray* o_rayToLight) {
     float3 fPosition = hit->intersection.xyz;
-    float3 fNormal = hit->normal;
-    float3 fColor = { 0.f, 0.f, 0.f };
-    float3 lightVec = { 0.f, 0.f, 0.f }, viewVec = { 0.f, 0.f, 0.f }, reflectVec = { 0.f, 0.f, 0.f };
-    float3 normalView = { 0.f, 0.f, 0.f };
-    float3 ambient = { 0.f, 0.f, 0.f }, diffuse = { 0.f, 0.f, 0.f }, specular = { 0.f, 0.f, 0.f };
-    float nDotL, rDotV;
-
-    for (int lightIndex = 0; lightIndex < LIGHT_COUNT; ++lightIndex) {
-        const Light* light = &lights[lightIndex];
-        if (light->position.w != 0)
-            lightVec = light->position.xyz - fPosition.xyz;
-        else
-            lightVec = -light->position.xyz;
-
-        // Shoot ray towards light source, any hit means shadow.
-        Ray rayToLight;
-        rayToLight.start = (float4)(fPosition, 1.f);
-        rayToLight.direction = (float4)(lightVec, 0.f);
-        // Need 'skin' width to avoid hitting itself.
-        rayToLight.start += 0.01f * (float4)(normalize(rayToLight.direction.xyz), 0);
-        HitRecord shadowcastHit;
-        shadowcastHit.time = MAX_FLOAT;
+    float3 lightVec;
+    if (light->position.w != 0)
+        lightVec = light->position.xyz - fPosition.xyz;
+    else
+        lightVec = -light->position.xyz;
+
+    float3 normalView = normalize(hit->normal);
+    float nDotL = dot(normalView, normalize(lightVec));
+    // Facing away, no need for the shadow ray
+    if (nDotL <= 0.f) return (float3)(0.f, 0.f, 0.f);
+
+    // Shoot ray towards light source, any hit means shadow.
+    o_rayToLight->start = (float4)(fPosition, 1.f);
+    o_rayToLight->direction = (float4)(lightVec, 0.f);
+    // Need 'skin' width to avoid hitting itself.
+    o_rayToLight->start += 0.01f * (float4)(normalize(o_rayToLight->direction.xyz), 0);
+
+    lightVec = normalize(lightVec);
+    float3 viewVec = normalize(eye - fPosition);
+    float3 reflectVec = normalize(reflect(-lightVec, normalView));
+    float rDotV = fmax(dot(reflectVec, viewVec), 0.0f);
+
+    float3 diffuse = componentWiseMultiply(hit->mat.diffuse, light->diffuse) * nDotL;
+    float3 specular = componentWiseMultiply(hit->mat.specular, light->specular) * pow(rDotV, fmax(hit->mat.shininess, 1.f));
+    return diffuse + specular;
+}
 
-        raycast(OBJECT_COUNT, objs, &rayToLight, &shadowcastHit);
+// Diffuse and specular from one light, zero when something is in the way
+float3 directLight(const ulong OBJECT_COUNT, __global const ObjectData* objs, __global const Light* light, const HitRecord* hit, const float3 eye, uint4* cost) {
+    Ray rayToLight;
+    float3 contribution = unshadowedLight(light, hit, eye, &rayToLight);
+    if (!any(contribution != 0.f)) return contribution;
 
-        lightVec = normalize(lightVec);
+    HitRecord shadowcastHit;
+    shadowcastHit.time = MAX_FLOAT;
 
-        float3 tNormal = fNormal;
-        normalView = normalize(tNormal);
-        nDotL = dot(normalView, lightVec);
+    cost->y++;
+    countedRaycast(OBJECT_COUNT, objs, &rayToLight, &shadowcastHit, cost);
 
-        viewVec = -fPosition;
-        viewVec = normalize(viewVec);
+    // Something sits between the point and the light
+    if (shadowcastHit.time < 1.f && shadowcastHit.time >= 0) return (float3)(0.f, 0.f, 0.f);
 
-        reflectVec = reflect(-lightVec, normalView);
-        reflectVec = normalize(reflectVec);
+    return contribution;
+}
 
-        rDotV = dot(reflectVec, viewVec);
-        rDotV = fmax(rDotV, 0.0f);
+inline float randomFloat(uint* state) {
+    // xorshift32, the state must never be 0
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return (*state >> 8) * (1.f / 16777216.f);
+}
 
-        ambient = componentWiseMultiply(hit->mat.ambient, light->ambient);
+// Upper bound on what the lights below a node can add. Shading has no distance falloff, so this is their power
+// times the largest cosine any point of the node's bounds can make with the normal.
+inline float lightNodeImportance(__global const LightNode* node, const float3 position, const float3 normal) {
+    float3 center = 0.5f * (node->boundsMin.xyz + node->boundsMax.xyz);
+    float radius = 0.5f * length(node->boundsMax.xyz - node->boundsMin.xyz);
+    float3 toCenter = center - position;
+    float distance = length(toCenter);
 
-        // Object cannot directly see the light
-        if (shadowcastHit.time >= 1.f || shadowcastHit.time < 0) {
-            diffuse = componentWiseMultiply(hit->mat.diffuse, light->diffuse) * fmax(nDotL, 0.f);
-            if (nDotL > 0)
-                specular = componentWiseMultiply(hit->mat.specular, light->specular) * pow(rDotV, fmax(hit->mat.shininess, 1.f));
+    // Inside the bounds, any direction is possible
+    if (distance <= radius) return node->boundsMin.w;
+
+    float angle = acos(clamp(dot(normal, toCenter / distance), -1.f, 1.f));
+    float boundedAngle = fmax(angle - asin(radius / distance), 0.f);
+    return node->boundsMin.w * fmax(cos(boundedAngle), 0.f);
+}
+
+// Walks the light tree, choosing children in proportion to their importance. Returns the light's index and the probability it was picked with.
+int pickLight(__global const LightNode* lightNodes, const float3 position, const float3 normal, uint* rngState, float* o_pdf) {
+    int node = 0;
+    *o_pdf = 1.f;
+
+    while (lightNodes[node].links.z < 0) {
+        int left = lightNodes[node].links.x, right = lightNodes[node].links.y;
+        float leftImportance = lightNodeImportance(&lightNodes[left], position, normal);
+        float rightImportance = lightNodeImportance(&lightNodes[right], position, normal);
+        float total = leftImportance + rightImportance;
+
+        // Nothing below here can light the point, any pick adds nothing
+        float leftChance = (total > 0.f) ? leftImportance / total : 0.5f;
+        if (randomFloat(rngState) < leftChance) {
+            node = left;
+            *o_pdf *= leftChance;
         }
         else {
-            diffuse = (float3)(0., 0., 0.);
-            specular = (float3)(0., 0., 0.);
+            node = right;
+            *o_pdf *= 1.f - leftChance;
         }
-        fColor = ambient + diffuse + specular;
     }
 
-    return fColor;
+    return lightNodes[node].links.z;
 }
 
-__kernel void shade_and_reflect(const uint MAX_BOUNCES, const uint OBJECT_COUNT, __global const ObjectData* objs, const uint LIGHT_COUNT, __global const Light* lights, __global const Ray* rays, __global float3* pixelData) {
-    // Get the index of the current element to be processed
-    int ii = get_global_id(0);
+// eye is the origin of the ray that produced hit. With lightSamples of 0 every light is shadow tested,
+// otherwise that many lights are picked from the light tree by importance and weighted by their probability.
+float3 shade(const ulong OBJECT_COUNT, __global const ObjectData* objs, const ulong LIGHT_COUNT, __global const Light* lights, const HitRecord* hit, const float3 eye,
+    __global const LightNode* lightNodes, const uint lightSamples, const float3 ambientLight, uint* rngState, uint4* cost) {
+    // Ambient needs no visibility, so it is taken from the summed ambient of all lights
+    float3 fColor = componentWiseMultiply(hit->mat.ambient, ambientLight);
+
+    if (lightSamples == 0) {
+        for (int lightIndex = 0; lightIndex < LIGHT_COUNT; ++lightIndex) {
+            fColor += directLight(OBJECT_COUNT, objs, &lights[lightIndex], hit, eye, cost);
+        }
+        return fColor;
+    }
+
+    float3 position = hit->intersection.xyz;
+    float3 normal = normalize(hit->normal);
+    float3 direct = { 0.f, 0.f, 0.f };
+    for (uint sample = 0; sample < lightSamples; ++sample) {
+        float pdf;
+        int light = pickLight(lightNodes, position, normal, rngState, &pdf);
+
+        if (pdf > 0.f)
+            direct += directLight(OBJECT_COUNT, objs, &lights[light], hit, eye, cost) / pdf;
+    }
+
+    return fColor + direct / (float)lightSamples;
+}
+
+// Spreads neighboring pixel indices so refreshes are scattered over the image
+inline uint hashIndex(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// Finds where a scene space point was seen in the previous frame, and whether the same surface was visible there.
+// prevProjection holds the previous camera's focal length, then where its optical axis fell in the rendered pixels,
+// off center for cropped cameras.
+bool reproject(const float4 position, const float16 sceneToPrevCamera, const float4 prevProjection, const uint width, const uint height, const float depthTolerance,
+    __global const float* prevDepthData, int* o_prevIndex) {
+    float4 prevCameraPos;
+    transform(&prevCameraPos, &sceneToPrevCamera, &position);
+
+    // Behind the previous camera
+    if (prevCameraPos.z >= 0.f) return false;
+
+    // Inverse of the ray setup in Camera::GenerateRays
+    float scale = prevProjection.x / -prevCameraPos.z;
+    int px = (int)round(prevProjection.y + prevCameraPos.x * scale);
+    int py = (int)round(prevProjection.z - prevCameraPos.y * scale);
+    if (px < 0 || px >= (int)width || py < 0 || py >= (int)height) return false;
+
+    *o_prevIndex = py * width + px;
+    float prevDepth = prevDepthData[*o_prevIndex];
+
+    // Background or a different surface was visible there
+    return prevDepth > 0.f && fabs(prevDepth - length(prevCameraPos.xyz)) <= depthTolerance * prevDepth;
+}
+
+// Launches are either 1-D over the pixels in row-major order or 2-D over (x, y), both padded to whole work-groups.
+// Returns -1 for the padding items.
+inline int pixelIndex(const uint width, const uint height) {
+    if (get_work_dim() == 1) {
+        uint ii = get_global_id(0);
+        return (ii < width * height) ? (int)ii : -1;
+    }
+
+    uint x = get_global_id(0), y = get_global_id(1);
+    return (x < width && y < height) ? (int)(y * width + x) : -1;
+}
 
+// Traces one pixel, the body of shade_and_reflect. o_cost collects the work it took.
+void tracePixel(const int ii, uint4* o_cost, const uint MAX_BOUNCES, const uint OBJECT_COUNT, __global const ObjectData* objs, const uint LIGHT_COUNT, __global const Light* lights, __global const Ray* rays, __global float4* pixelData,
+    __global float* depthData, __global float4* normalData, __global float4* albedoData,
+    const uint width, const uint height, const uint reprojectEnabled, const float16 sceneToPrevCamera, const float4 prevProjection, const float depthTolerance,
+    const uint frameIndex, const uint refreshInterval, __global const float4* prevPixelData, __global const float* prevDepthData,
+    __global const LightNode* lightNodes, const uint lightSamples, const float4 ambientLight, const float rouletteThreshold,
+    __global PrimaryHit* primaryHits, const uint reusePrimaryHits) {
     HitRecord hit;
     hit.time = MAX_FLOAT;
 
-    if (!raycast(OBJECT_COUNT, objs, &rays[ii], &hit)) return;
+    bool hasHit;
+    if (reusePrimaryHits) {
+        PrimaryHit primaryHit = primaryHits[ii];
+        hasHit = primaryHit.object >= 0;
+        if (hasHit) {
+            hit.intersection = primaryHit.intersection;
+            hit.normal = primaryHit.normal.xyz;
+            hit.reflection = primaryHit.reflection.xyz;
+            hit.time = primaryHit.time;
+            hit.object = primaryHit.object;
+            hit.mat = objs[primaryHit.object].mat;
+        }
+    }
+    else {
+        hasHit = countedRaycast(OBJECT_COUNT, objs, &rays[ii], &hit, o_cost);
+
+        primaryHits[ii].intersection = hit.intersection;
+        primaryHits[ii].normal = (float4)(hit.normal, 0.f);
+        primaryHits[ii].reflection = (float4)(hit.reflection, 0.f);
+        primaryHits[ii].time = hit.time;
+        primaryHits[ii].object = hasHit ? hit.object : -1;
+    }
+
+    if (!hasHit) {
+        pixelData[ii] = (float4)(0.f, 0.f, 0.f, 1.f);
+        // Depth of 0 marks background for the denoiser
+        depthData[ii] = 0.f;
+        normalData[ii] = (float4)(0.f, 0.f, 0.f, 0.f);
+        albedoData[ii] = (float4)(0.f, 0.f, 0.f, 0.f);
+        return;
+    }
+
+    // Guide buffers for the denoiser, taken from the primary hit
+    depthData[ii] = length(hit.intersection.xyz - rays[ii].start.xyz);
+    normalData[ii] = (float4)(hit.normal, 0.f);
+    albedoData[ii] = (float4)(hit.mat.diffuse, 1.f);
+
+    // Reuse last frame's color for surfaces that were already visible, except for a rotating set of refreshed pixels
+    if (reprojectEnabled && (hashIndex(ii) + frameIndex) % refreshInterval != 0) {
+        int prevIndex;
+        if (reproject((float4)(hit.intersection.xyz, 1.f), sceneToPrevCamera, prevProjection, width, height, depthTolerance, prevDepthData, &prevIndex)) {
+            pixelData[ii] = prevPixelData[prevIndex];
+            return;
+        }
+    }
+
+    // Different light picks every pixel and every frame
+    uint rngState = hashIndex(ii ^ hashIndex(frameIndex)) | 1;
 
     float3 absorbColor = { 0.f, 0.f, 0.f }, reflectColor = { 0.f, 0.f, 0.f }, transparencyColor = { 0.f, 0.f, 0.f };
 
-    absorbColor = hit.mat.absorption * shade(OBJECT_COUNT, objs, LIGHT_COUNT, lights, &hit);
+    absorbColor = hit.mat.absorption * shade(OBJECT_COUNT, objs, LIGHT_COUNT, lights, &hit, rays[ii].start.xyz, lightNodes, lightSamples, ambientLight.xyz, &rngState, o_cost);
     float absorptionPercent = hit.mat.absorption;
     
     uint bounces = MAX_BOUNCES;
@@ -264,13 +455,28 @@ __kernel void shade_and_reflect(const uint MAX_BOUNCES, const uint OBJECT_COUNT,
     HitRecord reflectionHit;
     reflectionHit.time = MAX_FLOAT;
     float reflectedAbsorbtion;
+    // Compensates for the paths russian roulette ended early
+    float pathWeight = 1.f;
+    bool terminated = false;
 
-    while (bounces-- > 0 && raycast(OBJECT_COUNT, objs, &reflectionRay, &reflectionHit) && absorptionPercent <= 0.999f) {
-        reflectColor = shade(OBJECT_COUNT, objs, LIGHT_COUNT, lights, &reflectionHit);
+    while (bounces-- > 0 && countedRaycast(OBJECT_COUNT, objs, &reflectionRay, &reflectionHit, o_cost) && absorptionPercent <= 0.999f) {
+        o_cost->z++;
+        reflectColor = shade(OBJECT_COUNT, objs, LIGHT_COUNT, lights, &reflectionHit, reflectionRay.start.xyz, lightNodes, lightSamples, ambientLight.xyz, &rngState, o_cost);
         reflectedAbsorbtion = (1.f - absorptionPercent) * reflectionHit.mat.absorption;
-        absorbColor += reflectedAbsorbtion * reflectColor;
+        absorbColor += pathWeight * reflectedAbsorbtion * reflectColor;
         absorptionPercent += reflectedAbsorbtion;
 
+        // Once little is left to gain, stop at random and scale up the survivors so the average stays the same
+        float throughput = pathWeight * (1.f - absorptionPercent);
+        if (throughput < rouletteThreshold) {
+            float survival = throughput / rouletteThreshold;
+            if (randomFloat(&rngState) >= survival) {
+                terminated = true;
+                break;
+            }
+            pathWeight /= survival;
+        }
+
         // reinitialize values for next iteration
         reflectionRay.start = reflectionHit.intersection;
         reflectionRay.direction = (float4)(reflectionHit.reflection, 0.f);
@@ -278,8 +484,313 @@ __kernel void shade_and_reflect(const uint MAX_BOUNCES, const uint OBJECT_COUNT,
         reflectionHit.time = MAX_FLOAT;
     }
 
-    if (bounces == 0 && absorptionPercent < 1.f)
-        absorbColor += (1.f - absorptionPercent) * reflectColor;
+    if (!terminated && bounces == 0 && absorptionPercent < 1.f)
+        absorbColor += pathWeight * (1.f - absorptionPercent) * reflectColor;
+
+    pixelData[ii] = (float4)(absorbColor, 1.f);
+}
+
+__kernel void shade_and_reflect(const uint MAX_BOUNCES, const uint OBJECT_COUNT, __global const ObjectData* objs, const uint LIGHT_COUNT, __global const Light* lights, __global const Ray* rays, __global float4* pixelData,
+    __global float* depthData, __global float4* normalData, __global float4* albedoData,
+    const uint width, const uint height, const uint reprojectEnabled, const float16 sceneToPrevCamera, const float4 prevProjection, const float depthTolerance,
+    const uint frameIndex, const uint refreshInterval, __global const float4* prevPixelData, __global const float* prevDepthData,
+    __global const LightNode* lightNodes, const uint lightSamples, const float4 ambientLight, const float rouletteThreshold,
+    __global PrimaryHit* primaryHits, const uint reusePrimaryHits,
+    __global uint* workCounter, const uint persistentThreads, __global uint4* costData, const uint recordCost) {
+    __local uint batchStart;
+    uint count = width * height;
+
+    // Persistent threads run about one work-group per compute unit, each taking the next batch of pixels from workCounter
+    // until none are left, so groups that finish cheap pixels early move on instead of idling
+    for (;;) {
+        int ii;
+        if (persistentThreads) {
+            if (get_local_id(0) == 0)
+                batchStart = atomic_add(workCounter, (uint)get_local_size(0));
+            barrier(CLK_LOCAL_MEM_FENCE);
+            uint start = batchStart;
+            // Every lane has read the batch before the next one overwrites it
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            if (start >= count) return;
+            ii = start + get_local_id(0);
+            if (ii >= count) continue;
+        }
+        else {
+            // Get the index of the current element to be processed
+            ii = pixelIndex(width, height);
+            if (ii < 0) return;
+        }
+
+        uint4 cost = (uint4)(0, 0, 0, 0);
+        tracePixel(ii, &cost, MAX_BOUNCES, OBJECT_COUNT, objs, LIGHT_COUNT, lights, rays, pixelData, depthData, normalData, albedoData, width, height, reprojectEnabled, sceneToPrevCamera, prevProjection, depthTolerance, frameIndex, refreshInterval, prevPixelData, prevDepthData, lightNodes, lightSamples, ambientLight, rouletteThreshold, primaryHits, reusePrimaryHits);
+        if (recordCost)
+            costData[ii] = cost;
+
+        if (!persistentThreads) return;
+    }
+}
+
+
+// Out-of-core tracing. Objects arrive in chunks, so every ray is carried through the passes below in device memory instead of
+// being followed to the end by one work item. Each step traces the current rays against every chunk, shades the closest hits
+// with one shadow ray sweep per light slot, then continues with the reflections. Mirrors shade_and_reflect.
+
+// Must match cl_PathState in OpenCLRaytracer.hpp
+typedef struct PathState {
+    Ray ray;
+    // Summed color so far, shade of the current hit and shade of the last reflection hit
+    float4 color, shade, lastReflection;
+    float absorption, pathWeight;
+    uint rngState, bounces;
+    // Set while the path still needs tracing, depth 0 is the primary hit
+    uint active, depth;
+    uint spacer[2];
+} PathState;
+
+// Must match cl_ShadowRay in OpenCLRaytracer.hpp
+typedef struct ShadowRay {
+    Ray ray;
+    // What the light adds if the ray reaches it, zero once blocked
+    float4 contribution;
+} ShadowRay;
+
+// Whether the ray passes through the box somewhere in [0, maxTime]
+bool intersectsBounds(const Ray* ray, const float4 boundsMin, const float4 boundsMax, const float maxTime) {
+    float3 invDirection = 1.f / ray->direction.xyz;
+    float3 t1 = (boundsMin.xyz - ray->start.xyz) * invDirection;
+    float3 t2 = (boundsMax.xyz - ray->start.xyz) * invDirection;
+    float3 tNear = fmin(t1, t2), tFar = fmax(t1, t2);
+
+    float enter = fmax(fmax(tNear.x, tNear.y), fmax(tNear.z, 0.f));
+    float exit = fmin(fmin(tFar.x, tFar.y), fmin(tFar.z, maxTime));
+    return enter <= exit;
+}
+
+inline void finishPath(__global PathState* path, const bool addTail, __global float4* pixel) {
+    // Same as the ray running out of bounces in shade_and_reflect
+    if (addTail && path->bounces == 0 && path->absorption < 1.f)
+        path->color.xyz += path->pathWeight * (1.f - path->absorption) * path->lastReflection.xyz;
+
+    *pixel = (float4)(path->color.xyz, 1.f);
+    path->active = 0;
+}
+
+__kernel void stream_begin_paths(const uint count, const uint MAX_BOUNCES, const uint frameIndex, __global const Ray* rays, __global PathState* paths, __global HitRecord* hits) {
+    int ii = get_global_id(0);
+    if (ii >= count) return;
+
+    __global PathState* path = &paths[ii];
+    path->ray = rays[ii];
+    path->color = path->shade = path->lastReflection = (float4)(0.f, 0.f, 0.f, 0.f);
+    path->absorption = 0.f;
+    path->pathWeight = 1.f;
+    // Different light picks every pixel and every frame
+    path->rngState = hashIndex(ii ^ hashIndex(frameIndex)) | 1;
+    path->bounces = MAX_BOUNCES;
+    path->active = 1;
+    path->depth = 0;
+
+    hits[ii].time = MAX_FLOAT;
+}
+
+// hits carries the closest hit so far from chunk to chunk
+__kernel void stream_closest_hit(const uint chunkSize, __global const ObjectData* chunk, const float4 chunkMin, const float4 chunkMax,
+    const uint count, __global const PathState* paths, __global HitRecord* hits) {
+    int ii = get_global_id(0);
+    if (ii >= count || !paths[ii].active) return;
+
+    Ray ray = paths[ii].ray;
+    HitRecord hit = hits[ii];
+    // Nothing in this chunk can be closer than what was already found
+    if (!intersectsBounds(&ray, chunkMin, chunkMax, hit.time)) return;
+
+    raycast(chunkSize, chunk, &ray, &hit);
+    hits[ii] = hit;
+}
+
+// Handles misses and, on the primary hit, the denoiser guides and reprojection. Survivors start shading with ambient.
+__kernel void stream_begin_shading(const uint width, const uint height, __global PathState* paths, __global const HitRecord* hits,
+    __global float4* pixelData, __global float* depthData, __global float4* normalData, __global float4* albedoData,
+    const uint reprojectEnabled, const float16 sceneToPrevCamera, const float4 prevProjection, const float depthTolerance,
+    const uint frameIndex, const uint refreshInterval, __global const float4* prevPixelData, __global const float* prevDepthData, const float4 ambientLight) {
+    int ii = get_global_id(0);
+    if (ii >= width * height || !paths[ii].active) return;
+
+    __global PathState* path = &paths[ii];
+    HitRecord hit = hits[ii];
+    bool missed = hit.time == MAX_FLOAT;
+
+    if (path->depth == 0) {
+        if (missed) {
+            pixelData[ii] = (float4)(0.f, 0.f, 0.f, 1.f);
+            // Depth of 0 marks background for the denoiser
+            depthData[ii] = 0.f;
+            normalData[ii] = (float4)(0.f, 0.f, 0.f, 0.f);
+            albedoData[ii] = (float4)(0.f, 0.f, 0.f, 0.f);
+            path->active = 0;
+            return;
+        }
+
+        depthData[ii] = length(hit.intersection.xyz - path->ray.start.xyz);
+        normalData[ii] = (float4)(hit.normal, 0.f);
+        albedoData[ii] = (float4)(hit.mat.diffuse, 1.f);
+
+        if (reprojectEnabled && (hashIndex(ii) + frameIndex) % refreshInterval != 0) {
+            int prevIndex;
+            if (reproject((float4)(hit.intersection.xyz, 1.f), sceneToPrevCamera, prevProjection, width, height, depthTolerance, prevDepthData, &prevIndex)) {
+                pixelData[ii] = prevPixelData[prevIndex];
+                path->active = 0;
+                return;
+            }
+        }
+    }
+    else if (missed) {
+        finishPath(path, true, &pixelData[ii]);
+        return;
+    }
+
+    path->shade = (float4)(componentWiseMultiply(hit.mat.ambient, ambientLight.xyz), 0.f);
+}
+
+// Shadow rays for slotCount lights per path, stored slot-major so one occlusion sweep tests them all. Slots are
+// light indices from firstSlot on when lightSamples is 0 and sample numbers otherwise.
+// liveCounts[0] counts the paths being shaded, liveCounts[1] the shadow rays that still need an occlusion sweep.
+__kernel void stream_shadow_rays(const uint count, __global PathState* paths, __global const HitRecord* hits, __global ShadowRay* shadows,
+    __global const Light* lights, __global const LightNode* lightNodes, const uint lightSamples, const uint firstSlot, const uint slotCount,
+    __global uint* liveCounts) {
+    int ii = get_global_id(0);
+    if (ii >= count) return;
+
+    for (uint slot = 0; slot < slotCount; ++slot) {
+        shadows[slot * count + ii].contribution = (float4)(0.f, 0.f, 0.f, 0.f);
+    }
+    if (!paths[ii].active) return;
+    atomic_inc(&liveCounts[0]);
+
+    HitRecord hit = hits[ii];
+    float3 eye = paths[ii].ray.start.xyz;
+    uint rngState = paths[ii].rngState;
+
+    for (uint slot = 0; slot < slotCount; ++slot) {
+        int light = firstSlot + slot;
+        float weight = 1.f;
+        if (lightSamples > 0) {
+            float pdf;
+            light = pickLight(lightNodes, hit.intersection.xyz, normalize(hit.normal), &rngState, &pdf);
+
+            if (pdf <= 0.f) continue;
+            weight = 1.f / (pdf * lightSamples);
+        }
+
+        Ray rayToLight;
+        float3 contribution = unshadowedLight(&lights[light], &hit, eye, &rayToLight) * weight;
+        __global ShadowRay* shadow = &shadows[slot * count + ii];
+        shadow->ray = rayToLight;
+        shadow->contribution = (float4)(contribution, 0.f);
+        if (any(contribution != 0.f))
+            atomic_inc(&liveCounts[1]);
+    }
+    paths[ii].rngState = rngState;
+}
+
+__kernel void stream_occlusion(const uint chunkSize, __global const ObjectData* chunk, const float4 chunkMin, const float4 chunkMax,
+    const uint count, __global ShadowRay* shadows) {
+    int ii = get_global_id(0);
+    if (ii >= count || !any(shadows[ii].contribution.xyz != 0.f)) return;
+
+    Ray ray = shadows[ii].ray;
+    if (!intersectsBounds(&ray, chunkMin, chunkMax, 1.f)) return;
+
+    HitRecord shadowcastHit;
+    shadowcastHit.time = MAX_FLOAT;
+    raycast(chunkSize, chunk, &ray, &shadowcastHit);
+
+    // Something sits between the point and the light
+    if (shadowcastHit.time < 1.f && shadowcastHit.time >= 0)
+        shadows[ii].contribution = (float4)(0.f, 0.f, 0.f, 0.f);
+}
+
+__kernel void stream_add_shadow(const uint count, __global PathState* paths, __global const ShadowRay* shadows, const uint slotCount) {
+    int ii = get_global_id(0);
+    if (ii >= count || !paths[ii].active) return;
+
+    for (uint slot = 0; slot < slotCount; ++slot) {
+        paths[ii].shade += shadows[slot * count + ii].contribution;
+    }
+}
+
+// Adds the finished shade to the path and sets up the reflection ray, or ends the path
+__kernel void stream_end_shading(const uint count, __global PathState* paths, __global HitRecord* hits, __global float4* pixelData, const float rouletteThreshold) {
+    int ii = get_global_id(0);
+    if (ii >= count || !paths[ii].active) return;
+
+    __global PathState* path = &paths[ii];
+    HitRecord hit = hits[ii];
+    float3 shadeColor = path->shade.xyz;
+
+    if (path->depth == 0) {
+        path->color.xyz = hit.mat.absorption * shadeColor;
+        path->absorption = hit.mat.absorption;
+    }
+    else {
+        float reflectedAbsorbtion = (1.f - path->absorption) * hit.mat.absorption;
+        path->color.xyz += path->pathWeight * reflectedAbsorbtion * shadeColor;
+        path->absorption += reflectedAbsorbtion;
+        path->lastReflection.xyz = shadeColor;
+
+        float throughput = path->pathWeight * (1.f - path->absorption);
+        if (throughput < rouletteThreshold) {
+            uint rngState = path->rngState;
+            float survival = throughput / rouletteThreshold;
+            bool survived = randomFloat(&rngState) < survival;
+            path->rngState = rngState;
+
+            if (!survived) {
+                finishPath(path, false, &pixelData[ii]);
+                return;
+            }
+            path->pathWeight /= survival;
+        }
+    }
+
+    if (path->bounces == 0) {
+        finishPath(path, false, &pixelData[ii]);
+        return;
+    }
+    --path->bounces;
+
+    if (path->absorption > 0.999f) {
+        finishPath(path, true, &pixelData[ii]);
+        return;
+    }
+
+    path->ray.start = hit.intersection;
+    path->ray.direction = (float4)(hit.reflection, 0.f);
+    path->ray.start += (float4)(normalize(path->ray.direction.xyz), 0.f) * 0.001f;
+    path->depth++;
+    hits[ii].time = MAX_FLOAT;
+}
 
-    pixelData[ii] = absorbColor;
+// Must match cl_ViewCamera in OpenCLRaytracer.hpp
+typedef struct ViewCamera {
+    // Columns of the camera to scene transform, the origin last
+    float4 axisX, axisY, axisZ, origin;
+    // Ray direction of the view's top left pixel in camera space before the focal length, then the focal length
+    float4 projection;
+} ViewCamera;
+
+// Views are stacked into one tall image, a work item's view is its row divided by the view height.
+// Same rays as Camera::GenerateRays.
+__kernel void generate_view_rays(const uint width, const uint viewHeight, const uint count, const uint firstView, __global const ViewCamera* views, __global Ray* rays) {
+    uint ii = get_global_id(0);
+    if (ii >= count) return;
+
+    uint row = ii / width;
+    __global const ViewCamera* view = &views[firstView + row / viewHeight];
+    float x = view->projection.x + (float)(ii % width);
+    float y = view->projection.y - (float)(row % viewHeight);
+
+    rays[ii].start = view->origin;
+    rays[ii].direction = x * view->axisX + y * view->axisY - view->projection.z * view->axisZ;
 }